@@ -0,0 +1,345 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <numeric>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include "../util/ArgParser.h"
+#include "../util/jsonrecord.h"
+#include "../util/linepipeline.h"
+#include "../util/pgzipstream.h"
+
+struct Options {
+    unsigned long max_repeat;   // 0 for no limit
+    long gap;                   // negative: pairs are not merged
+    long min_lines;
+    bool bigclonebench;
+    unsigned threads;
+};
+
+// lines of one side of a clone pair, both inclusive
+struct Region {
+    uint32_t start;
+    uint32_t end;
+};
+
+struct ClonePair {
+    Region a;
+    Region b;
+};
+
+bool operator<(const ClonePair &x, const ClonePair &y) {
+    return std::tie(x.a.start, x.a.end, x.b.start, x.b.end) < std::tie(y.a.start, y.a.end, y.b.start, y.b.end);
+}
+
+bool operator==(const ClonePair &x, const ClonePair &y) {
+    return !(x < y) && !(y < x);
+}
+
+// pairs generated from a block of records, keyed by the (first file, second file) ids local to the block
+struct PairBlock {
+    std::vector<std::string> paths;
+    std::vector<std::pair<uint64_t, ClonePair>> pairs;
+};
+
+// all the pairs between two files
+struct FilePair {
+    uint32_t first_path;
+    uint32_t second_path;
+    std::vector<ClonePair> pairs;
+};
+
+void append_number(std::string &out, unsigned long value) {
+    char buffer[24];
+    auto res = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, res.ptr - buffer);
+}
+
+// non-ASCII characters are written as python's 'backslashreplace' error handler does
+void append_ascii(std::string &out, std::string_view text) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < text.size(); i++) {
+        auto c = (unsigned char) text[i];
+        if (c < 0x80) {
+            out.push_back((char) c);
+            continue;
+        }
+        int length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+        unsigned long cp = c & (0x7F >> length);
+        bool valid = length && i + length <= text.size();
+        for (int k = 1; valid && k < length; k++) {
+            valid = ((unsigned char) text[i + k] & 0xC0) == 0x80;
+            cp = (cp << 6) | ((unsigned char) text[i + k] & 0x3F);
+        }
+        if (!valid) cp = c, length = 1;
+        int width = cp < 0x100 ? 2 : cp < 0x10000 ? 4 : 8;
+        out += width == 2 ? "\\x" : width == 4 ? "\\u" : "\\U";
+        for (int shift = 4 * (width - 1); shift >= 0; shift -= 4) out.push_back(digits[(cp >> shift) & 0xF]);
+        i += length - 1;
+    }
+}
+
+// "<directory>,<file name>" of a path, the directory being reduced to its last component for BigCloneBench
+std::string format_path(std::string_view path, bool bigclonebench) {
+    size_t slash = path.rfind('/');
+    std::string_view file = slash == std::string_view::npos ? path : path.substr(slash + 1);
+    std::string_view dir = slash == std::string_view::npos ? std::string_view() : path.substr(0, slash + 1);
+    // as os.path.dirname, trailing slashes are removed unless the directory is the root
+    if (dir.find_first_not_of('/') != std::string_view::npos) dir = dir.substr(0, dir.find_last_not_of('/') + 1);
+    if (bigclonebench && dir.rfind('/') != std::string_view::npos) dir = dir.substr(dir.rfind('/') + 1);
+
+    std::string formatted;
+    append_ascii(formatted, dir);
+    formatted.push_back(',');
+    append_ascii(formatted, file);
+    return formatted;
+}
+
+void append_pair(std::string &out, const std::string &first_path, const Region &a, const std::string &second_path,
+                 const Region &b) {
+    out += first_path;
+    out.push_back(',');
+    append_number(out, a.start);
+    out.push_back(',');
+    append_number(out, a.end);
+    out.push_back(',');
+    out += second_path;
+    out.push_back(',');
+    append_number(out, b.start);
+    out.push_back(',');
+    append_number(out, b.end);
+    out.push_back('\n');
+}
+
+bool spans(const Region &region, long min_lines) {
+    return (long) region.end - (long) region.start >= min_lines;
+}
+
+// order of the two sides of a pair: by path, then lines
+bool precedes(const RepeatLocation &x, const RepeatLocation &y) {
+    return std::tie(x.path, x.start_line, x.end_line) < std::tie(y.path, y.start_line, y.end_line);
+}
+
+Region region_of(const RepeatLocation &loc) {
+    return {(uint32_t) loc.start_line, (uint32_t) loc.end_line};
+}
+
+// calls f(first, second) for every pair of locations of a record, in order
+template<typename F>
+void for_each_pair(const RepeatRecord &record, const Options &opts, F f) {
+    size_t count = record.location_count;
+    if (opts.max_repeat != 0 && count > opts.max_repeat) return;
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = i + 1; j < count; j++) {
+            const RepeatLocation &x = record.locations[i];
+            const RepeatLocation &y = record.locations[j];
+            if (precedes(y, x)) f(y, x);
+            else f(x, y);
+        }
+    }
+}
+
+// length of the prefix of block made of complete lines, npos if there is none
+size_t complete_lines(std::string_view block) {
+    size_t cut = block.rfind('\n');
+    return cut == std::string_view::npos ? cut : cut + 1;
+}
+
+// Merges the pairs of two files that lie within gap lines of each other on both sides, directly or through other
+// pairs, into their bounding pair. The pairs are swept in order of their first side, keeping those whose first side
+// still reaches the sweep line; the connected pairs are joined with a union-find.
+std::vector<ClonePair> merge_pairs(std::vector<ClonePair> &pairs, unsigned long gap) {
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    std::vector<uint32_t> parent(pairs.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&parent](uint32_t i) {
+        while (parent[i] != i) i = parent[i] = parent[parent[i]];
+        return i;
+    };
+
+    std::vector<uint32_t> active;
+    for (uint32_t i = 0; i < pairs.size(); i++) {
+        const ClonePair &pair = pairs[i];
+        for (size_t k = 0; k < active.size();) {
+            const ClonePair &other = pairs[active[k]];
+            if ((uint64_t) other.a.end + gap + 1 < pair.a.start) {
+                active[k] = active.back();
+                active.pop_back();
+                continue;
+            }
+            if ((uint64_t) pair.b.start <= (uint64_t) other.b.end + gap + 1 &&
+                (uint64_t) other.b.start <= (uint64_t) pair.b.end + gap + 1) {
+                parent[find(i)] = find(active[k]);
+            }
+            k++;
+        }
+        active.push_back(i);
+    }
+
+    // bounding pair of every group, at the index of its root
+    std::vector<ClonePair> merged;
+    std::vector<uint32_t> slot(pairs.size(), UINT32_MAX);
+    for (uint32_t i = 0; i < pairs.size(); i++) {
+        uint32_t root = find(i);
+        if (slot[root] == UINT32_MAX) {
+            slot[root] = merged.size();
+            merged.push_back(pairs[i]);
+            continue;
+        }
+        ClonePair &box = merged[slot[root]];
+        box.a.start = std::min(box.a.start, pairs[i].a.start);
+        box.a.end = std::max(box.a.end, pairs[i].a.end);
+        box.b.start = std::min(box.b.start, pairs[i].b.start);
+        box.b.end = std::max(box.b.end, pairs[i].b.end);
+    }
+    std::sort(merged.begin(), merged.end());
+    return merged;
+}
+
+// without merging, the pairs of every record are written as they are generated
+void write_pairs(std::istream &in, std::ostream &out, const Options &opts) {
+    process_line_blocks(in, out, opts.threads, [&opts](std::string_view block, std::string &result) {
+        JsonRecordParser parser;
+        RepeatRecord record;
+        for_each_line(block, [&](std::string_view line) {
+            parser.parse(line, record);
+            for_each_pair(record, opts, [&](const RepeatLocation &x, const RepeatLocation &y) {
+                Region a = region_of(x), b = region_of(y);
+                if (spans(a, opts.min_lines) && spans(b, opts.min_lines)) {
+                    append_pair(result, format_path(x.path, opts.bigclonebench), a,
+                                format_path(y.path, opts.bigclonebench), b);
+                }
+            });
+        });
+    });
+}
+
+// pairs are generated in parallel blocks and gathered per file pair, in the order the file pairs first appear, then
+// merged and written per group of file pairs in parallel
+void write_merged_pairs(std::istream &in, std::ostream &out, const Options &opts) {
+    std::vector<std::string> paths;     // formatted
+    std::unordered_map<std::string, uint32_t> path_ids;
+    std::vector<FilePair> file_pairs;
+    std::unordered_map<uint64_t, uint32_t> file_pair_ids;
+
+    process_blocks<PairBlock>(in, opts.threads, complete_lines, [&opts](std::string_view block, PairBlock &result) {
+        JsonRecordParser parser;
+        RepeatRecord record;
+        std::unordered_map<std::string, uint32_t> ids;
+        auto id = [&](const std::string &path) {
+            auto it = ids.try_emplace(path, result.paths.size()).first;
+            if (it->second == result.paths.size()) result.paths.push_back(path);
+            return (uint64_t) it->second;
+        };
+        for_each_line(block, [&](std::string_view line) {
+            parser.parse(line, record);
+            for_each_pair(record, opts, [&](const RepeatLocation &x, const RepeatLocation &y) {
+                result.pairs.emplace_back(id(x.path) << 32 | id(y.path), ClonePair{region_of(x), region_of(y)});
+            });
+        });
+    }, [&](PairBlock &result) {
+        std::vector<uint32_t> global(result.paths.size());
+        for (size_t i = 0; i < result.paths.size(); i++) {
+            auto it = path_ids.try_emplace(std::move(result.paths[i]), paths.size()).first;
+            if (it->second == paths.size()) paths.push_back(format_path(it->first, opts.bigclonebench));
+            global[i] = it->second;
+        }
+        for (auto &[key, pair] : result.pairs) {
+            uint32_t first = global[key >> 32], second = global[key & UINT32_MAX];
+            auto it = file_pair_ids.try_emplace((uint64_t) first << 32 | second, file_pairs.size()).first;
+            if (it->second == file_pairs.size()) file_pairs.push_back({first, second, {}});
+            file_pairs[it->second].pairs.push_back(pair);
+        }
+    });
+
+    // tasks are ranges of file pairs holding enough pairs to be worth a thread
+    const size_t task_pairs = (size_t) 1 << 16;
+    size_t next = 0;
+    run_ordered<std::pair<size_t, size_t>>(opts.threads, [&](std::pair<size_t, size_t> &range) {
+        if (next == file_pairs.size()) return false;
+        size_t count = 0;
+        range.first = next;
+        while (next < file_pairs.size() && count < task_pairs) count += file_pairs[next++].pairs.size();
+        range.second = next;
+        return true;
+    }, [&](std::pair<size_t, size_t> &range, std::string &result) {
+        for (size_t i = range.first; i < range.second; i++) {
+            FilePair &file_pair = file_pairs[i];
+            for (const ClonePair &pair : merge_pairs(file_pair.pairs, opts.gap)) {
+                if (spans(pair.a, opts.min_lines) && spans(pair.b, opts.min_lines)) {
+                    append_pair(result, paths[file_pair.first_path], pair.a, paths[file_pair.second_path], pair.b);
+                }
+            }
+            std::vector<ClonePair>().swap(file_pair.pairs);
+        }
+    }, [&out](const std::string &result) {
+        out.write(result.data(), result.size());
+    });
+}
+
+std::optional<std::string> option(ArgParser &args, const std::string &short_name, const std::string &long_name) {
+    auto value = args.getCmdArg(short_name);
+    return value ? value : args.getCmdArg(long_name);
+}
+
+int main(int argc, char **argv) {
+    ArgParser args(argv + 1, argv + argc);
+
+    if (args.cmdOptionExists("-h") || args.cmdOptionExists("--help")) {
+        std::cout << "\nUsage:\t" << argv[0]
+                  << "\t[-i <input_file>]\t[-o <output_file>]\t[<options...>]\n"
+                     "Generates the clone pairs of the JSON lines of the postprocessor (plain or gzip-compressed),\n"
+                     "as 'dir,file,start,end,dir,file,start,end' lines.\n"
+                     "\t-R, --maxrepeat <n>\tskip repeats with more than n locations (0: no limit)\n"
+                     "\t-G, --gap <n>\t\tmerge pairs less than n lines apart on both sides (negative: no merging)\n"
+                     "\t-m, --minlines <n>\tminimal number of lines of both sides of a pair\n"
+                     "\t--bigclonebench\t\tonly the last component of the directories\n"
+                     "\t-j <n>\t\t\tnumber of worker threads\n";
+        exit(1);
+    }
+
+    Options opts{};
+    std::optional<std::string> input_file, output_file;
+    try {
+        opts.max_repeat = std::stoul(option(args, "-R", "--maxrepeat").value_or("0"));
+        opts.gap = std::stol(option(args, "-G", "--gap").value_or("0"));
+        opts.min_lines = std::stol(option(args, "-m", "--minlines").value_or("1"));
+        opts.bigclonebench = args.cmdOptionExists("--bigclonebench");
+        auto threads = args.getCmdArg("-j");
+        opts.threads = threads ? std::stoul(*threads) : std::max(1u, std::thread::hardware_concurrency());
+        input_file = option(args, "-i", "--input");
+        output_file = option(args, "-o", "--output");
+    } catch (std::exception &e) {
+        std::cerr << "Invalid arguments: " << e.what() << "\n";
+        exit(1);
+    }
+
+    std::unique_ptr<std::istream> inp(
+            input_file ? (std::istream *) new pgzstr::ifstream(*input_file) : new pgzstr::istream(dup(STDIN_FILENO)));
+    std::unique_ptr<std::ostream> outp;
+    if (output_file) outp.reset(new std::ofstream(*output_file, std::ios_base::binary));
+    std::ostream &out = outp ? *outp : std::cout;
+
+    if (!*inp || !out) {
+        std::cerr << "input or output file open fails. exit.\n";
+        exit(1);
+    }
+
+    try {
+        if (opts.gap < 0) {
+            write_pairs(*inp, out, opts);
+        } else {
+            write_merged_pairs(*inp, out, opts);
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Failed to generate clone pairs: " << e.what() << "\n";
+        exit(1);
+    }
+    return 0;
+}
@@ -1,7 +1,6 @@
 #!/usr/bin/env python3
 import argparse
 import os
-import shlex
 import subprocess
 
 from typing import List
@@ -42,25 +41,46 @@ def run_preprocessor(args, intermediary):
         pre_args.append('--symlinks')
     if args.delcmts:
         pre_args.append('--delete-comments');
+    if args.cache:
+        pre_args.extend(['--cache', args.cache])
+    if not args.in_process:
+        # mapped as they are by the postprocessor; findrepset reads the text maps
+        pre_args.append('--binary-maps')
+        if args.collapse_duplicates:
+            pre_args.extend(['--aliases', "{}.aliases".format(intermediary)])
     run(pre_args)
 
 
-def run_findrepset(args, intermediary):
+def run_findrepset(args, intermediary, output):
     base_cmd = [
         "{}/bin/findrepset".format(args.prefix),
         "-ml", str(args.minrepeat),
     ]
     if not args.supermax:
         base_cmd.append("-nm"),  # find maximal repeats, not supermaximal ones
-    concat_in = "{}.concat".format(intermediary)
+    if args.reference:
+        base_cmd.extend(["-ref", "-sa", "{}.sa".format(intermediary)])
+    if args.top:
+        base_cmd.extend(["-topk", str(args.top)])
+    if args.top or args.min_score:
+        base_cmd.extend(["-topkey", args.top_key])
+    if args.min_score:
+        base_cmd.extend(["-minscore", str(args.min_score)])
+    findrepset_out = "{}.output.txt".format(intermediary)
+    if args.in_process:
+        # findrepset writes the final JSON records itself
+        base_cmd.extend(["-charmap", "{}.charmap".format(intermediary), "-linemap", "{}.linemap".format(intermediary)])
+        if args.skip_blank:
+            base_cmd.append("-skipblank")
+        if args.skip_null:
+            base_cmd.append("-skipnull")
+        findrepset_out = output.name
     if args.compress:
-        base_cmd.append(concat_in)
-        cmd = " ".join([shlex.quote(c) for c in base_cmd]) + " -o /dev/fd/1 | gzip -c > " + shlex.quote(
-            "{}.output.txt.gz".format(intermediary))
-        print("Running '" + cmd + "'...")
-        subprocess.run(cmd, shell=True, check=True)
-    else:
-        run([*base_cmd, "-o", "{}.output.txt".format(intermediary), concat_in])
+        # block-parallel gzip inside findrepset
+        base_cmd.append("-z")
+        if not args.in_process:
+            findrepset_out += ".gz"
+    run([*base_cmd, "-o", findrepset_out, "{}.concat".format(intermediary)])
 
 
 def run_postprocessor(args, intermediary, output):
@@ -78,6 +98,20 @@ def run_postprocessor(args, intermediary, output):
         post_args.append('--skip-null')
     if args.compress:
         post_args.append('--compress')
+    if args.protobuf:
+        post_args.append('--protobuf')
+    if args.stream:
+        post_args.append('--stream')
+    if args.classes:
+        post_args.append('--classes')
+    if args.drop_nested:
+        post_args.append('--drop-nested')
+    if args.threads:
+        post_args.extend(['-j', str(args.threads)])
+    if args.reference:
+        post_args.extend(['--reference', "{}.concat".format(intermediary), "{}.sa".format(intermediary)])
+    if args.collapse_duplicates:
+        post_args.extend(['--aliases', "{}.aliases".format(intermediary), "{}.concat".format(intermediary)])
     run(post_args)
 
 
@@ -85,7 +119,7 @@ def run_scan(args):
     if not os.path.exists(args.src):
         raise argparse.ArgumentError("{} does not exist".format(args.src))
 
-    output = args.output or open(args.src + ".json" + (".gz" if args.compress else ""), "wb")
+    output = args.output or open(args.src + (".pb" if args.protobuf else ".json") + (".gz" if args.compress else ""), "wb")
 
     if args.intermediaries:
         intermediary = "{}/{}".format(args.intermediaries, os.path.basename(args.src))
@@ -100,9 +134,9 @@ def run_scan(args):
         run_preprocessor(args, intermediary)
 
     if run_all or "findrepeats" in args.run:
-        run_findrepset(args, intermediary)
+        run_findrepset(args, intermediary, output)
 
-    if run_all or "post" in args.run:
+    if (run_all or "post" in args.run) and not args.in_process:
         run_postprocessor(args, intermediary, output)
 
 
@@ -138,14 +172,47 @@ def parse_args():
                            help='Follow symlinks when processing the source directory')
     pre_group.add_argument('--delete-comments', dest='delcmts', action='store_true',
                            help='Remove c-style comments from the source code')
+    pre_group.add_argument('--cache',
+                           help='Directory of transformed files kept across scans, reused for files whose content '
+                                'and pre-processing options are unchanged')
+    pre_group.add_argument('--collapse-duplicates', dest='collapse_duplicates', action='store_true',
+                           help='Concatenate files with the same content once, and report their copies as whole-file '
+                                'repeats (ignored with --in-process)')
     find_group = parser.add_argument_group('Repeat Finding', 'Options for the "findmaxrep" step.')
     find_group.add_argument('--supermax', action='store_true', help='Use supermaximal repeats')
+    find_group.add_argument('--reference', action='store_true',
+                            help='Output text offsets and suffix array intervals instead of copies of every repeat, '
+                                 'and save the suffix array for the post-processing step')
+    find_group.add_argument('--in-process', dest='in_process', action='store_true',
+                            help='Post-process the repeats inside findrepset and write the JSON output directly, '
+                                 'without the intermediate repeat file and the "post" step (default: false)')
+    find_group.add_argument('--top', type=unsigned_int, default=0,
+                            help='Only keep the N best repeats according to --top-key (default: keep all)')
+    find_group.add_argument('--top-key', dest='top_key', choices=['len', 'occ', 'score'], default='score',
+                            help='Rank repeats by length, number of occurrences, or length times occurrences '
+                                 '(default: score)')
+    find_group.add_argument('--min-score', dest='min_score', type=unsigned_int, default=0,
+                            help='Only keep repeats ranking at least this value according to --top-key')
     post_group = parser.add_argument_group('Post-processing', 'Options for the "post" step')
     post_group.add_argument('--skip-blank', dest='skip_blank', action='store_true',
                             help='Skip repeated sequences that only contain whitespace and control code'
                                  '(default: false)')
     post_group.add_argument('--skip-null', dest='skip_null', action='store_true',
                             help='Skip repeated sequences that only contain null (default: false)')
+    post_group.add_argument('--stream', action='store_true',
+                            help='Emit repeats that need no split as soon as they are read, and only keep split '
+                                 'fragments in memory (default: false)')
+    post_group.add_argument('--classes', action='store_true',
+                            help='Consolidate repeats whose occurrences overlap in the same file into clone classes, '
+                                 'one record per class (default: false)')
+    post_group.add_argument('--drop-nested', dest='drop_nested', action='store_true',
+                            help='Drop repeats whose every occurrence lies inside an occurrence of a longer one '
+                                 '(default: false)')
+    post_group.add_argument('--threads', type=unsigned_int, default=0,
+                            help='Number of postprocessor worker threads (default: all cores)')
+    post_group.add_argument('--protobuf', action='store_true',
+                            help='Write length-delimited clonedetection.Repeat messages (see repeats.proto) '
+                                 'instead of JSON lines (default: false)')
     parser.set_defaults(launch=run_scan)
 
     return parser.parse_args()
@@ -86,12 +86,12 @@ uchar* loadStrFileExtraSpace(const char* filename, uint* n, uint esp) {
 /**
  * Writes a mem buffer to a new or existant file. Returns true if success.
  */
-bool saveStrFile(const char* fn, const void* buf, uint n) {
+bool saveStrFile(const char* fn, const void* buf, size_t n) {
 	bool res;
 	FILE* f = fopen(fn, "wb");
 	if (!f) return 0;
 	res =  n == fwrite(buf, 1, n, f);
-	fclose(f);
+	res = (fclose(f) == 0) && res;
 	return res;
 }
 
@@ -16,7 +16,7 @@ void _pz_free(void *ptr, char *file, int line);
 
 uchar* loadStrFile(const char*, uint* n);
 uchar* loadStrFileExtraSpace(const char*, uint* n, uint esp);
-bool saveStrFile(const char* fn, const void* buf, uint n);
+bool saveStrFile(const char* fn, const void* buf, size_t n);
 uchar* loadFile(FILE* f, uint* n);
 uchar* loadFileExtraSpace(FILE*, uint* n, uint esp);
 bool saveFile(FILE* f, const void* buf, uint n);
@@ -12,7 +12,10 @@
 #include "mmrs.h"
 #include "output_callbacks.h"
 #include "mrs.h"
+#include "postprocess.h"
+#include "topk.h"
 #include "tiempos.h"
+#include "pgzip.h"
 
 #define TIME_RUN_INIT tiempo __t1,__t2;
 #define TIME_RUN(var,op) { getTickTime(&__t1); { op; } getTickTime(&__t2); var = getTimeDiff(__t1, __t2); }
@@ -34,9 +37,11 @@ int main(int argc, char** argv) {
 	TIME_RUN_INIT
 	uint *p, *r, *h, *m, *mc, tn;
 	uchar *s, *st, *t;
-	char *outfile;
+	char *outfile = NULL, *safile = NULL, *charmapfile = NULL, *linemapfile = NULL;
 	uchar **filenames;
-	uint sn,n,i,j,ml = 1, nm = 0, c = 0, v = 0, at = 0, time = 0;
+	uint sn,n,i,j,ml = 1, nm = 0, c = 0, v = 0, at = 0, time = 0, ref = 0;
+	uint skipblank = 0, skipnull = 0, topk = 0, topkey = TOPK_SCORE, gz = 0, gzthreads = 0;
+	uint64 minscore = 0;
 	int ps = -1;
 	filter_data fdata;
 	double t_sarr = 0.0,t_lcp = 0.0,t_mcalc = 0.0,t_algo = 0.0;
@@ -45,10 +50,26 @@ int main(int argc, char** argv) {
 		if (0) {}
 		else cmdline_opt_2(i, "-ml") { ml = atoi(argv[i]); }
 		else cmdline_opt_2(i, "-o") { outfile = argv[i]; }
+		else cmdline_opt_2(i, "-sa") { safile = argv[i]; }
+		else cmdline_opt_2(i, "-charmap") { charmapfile = argv[i]; }
+		else cmdline_opt_2(i, "-linemap") { linemapfile = argv[i]; }
+		else cmdline_opt_2(i, "-topk") { topk = atoi(argv[i]); }
+		else cmdline_opt_2(i, "-minscore") { minscore = strtoull(argv[i], NULL, 10); }
+		else cmdline_opt_2(i, "-zthreads") { gzthreads = atoi(argv[i]); }
+		else cmdline_opt_2(i, "-topkey") {
+			if (!strcmp(argv[i], "len")) topkey = TOPK_LENGTH;
+			else if (!strcmp(argv[i], "occ")) topkey = TOPK_OCCURRENCES;
+			else if (!strcmp(argv[i], "score")) topkey = TOPK_SCORE;
+			else at = -argc-1;
+		}
 		else cmdline_var(i, "nm", nm)
 		else cmdline_var(i, "c", c)
 		else cmdline_var(i, "v", v)
 		else cmdline_var(i, "t", time)
+		else cmdline_var(i, "ref", ref)
+		else cmdline_var(i, "skipblank", skipblank)
+		else cmdline_var(i, "skipnull", skipnull)
+		else cmdline_var(i, "z", gz)
 		else {
 			if (ps == -1) ps = i;
 			if (ps+at != i) at = -argc-1;
@@ -56,7 +77,7 @@ int main(int argc, char** argv) {
 		}
 	}
 	
-	if (at < 1 || (nm && c)) {
+	if (at < 1 || (nm && c) || (!charmapfile != !linemapfile)) {
 		fprintf(stderr, "Usage: %s <file> <file1> [<file2>] [<file3>]"
 						" ... [options] \n"
 						"  -nm will run mrs instead of mmrs\n"
@@ -64,6 +85,15 @@ int main(int argc, char** argv) {
 						"  -c will find common patterns instead of own (default)\n"
 						"  -v gives more output in standard error (only to be used with pure text files)\n"
 						"  -t calculates running times (no data output)\n"
+						"  -ref outputs text offsets and suffix array intervals instead of copies\n"
+						"  -sa <file> saves the suffix array of <file> (needed to expand -ref output)\n"
+						"  -charmap <file> -linemap <file> write the postprocessed JSON records directly,\n"
+						"     skipping repeats no longer than the ml parameter after splitting\n"
+						"  -skipblank -skipnull also skip whitespace only and null only repeats (with -charmap)\n"
+						"  -topk <number> only outputs the <number> best repeats, once all are found\n"
+						"  -topkey len|occ|score ranks repeats by length, occurrences or both multiplied (default)\n"
+						"  -minscore <number> only outputs repeats reaching <number> with the -topkey ranking\n"
+						"  -z compresses the output with gzip, on -zthreads <number> threads (default: all)\n"
 						, argv[0]); 
 		return 1;
 	}
@@ -133,6 +163,11 @@ int main(int argc, char** argv) {
 	memcpy(h, r, sn*sizeof(uint));
 	TIME_RUN_AC(t_lcp,lcp(sn, s, h, p))
 
+	if (safile != NULL && !saveStrFile(safile, r, sn*sizeof(uint))) {
+		fprintf(stderr, "Could not save the suffix array to %s [%s]\n", safile, strerror(errno));
+		exit(1);
+	}
+
 	output_readable_data ord;
 	ord.r = r;
 	ord.s = s;
@@ -147,11 +182,37 @@ int main(int argc, char** argv) {
             exit(1);
         }
     }
+	if (gz && !time) {
+		ord.fp = pgzip_fwrap(ord.fp, PGZIP_DEFAULT_LEVEL, gzthreads);
+		if (!ord.fp) {
+			fprintf(stderr, "Could not start the compressed output\n");
+			exit(1);
+		}
+	}
+
+    output_callback *callback = time? output_nothing: ref? output_reference: output_findmaxrep;
+	void *cbdata = (void*) &ord;
+	postprocess_data ppd;
+
+	if (charmapfile != NULL && !time) {
+		if (!postprocess_init(&ppd, s, r, ord.fp, charmapfile, linemapfile, ml, skipblank, skipnull)) {
+			fprintf(stderr, "Could not load the charmap and linemap\n");
+			exit(1);
+		}
+		callback = output_postprocessed;
+		cbdata = (void*) &ppd;
+	}
 
-    output_callback *callback = time? output_nothing: output_findmaxrep;
+	topk_data td;
+
+	if ((topk || minscore) && !time) {
+		topk_init(&td, topk, topkey, minscore, callback, cbdata);
+		callback = topk_callback;
+		cbdata = (void*) &td;
+	}
 
 	if (!c) {
-		fdata.data = (void*) &ord;
+		fdata.data = cbdata;
 		fdata.filter = mc;
 		fdata.r = r;
 		fdata.callback = callback;
@@ -159,7 +220,18 @@ int main(int argc, char** argv) {
 		if (nm) TIME_RUN_AC(t_algo,mrs(s, sn, r, h, p, ml, own_filter_callback, &fdata))	
 		else TIME_RUN_AC(t_algo,mmrs(s, sn, r, h, ml, own_filter_callback, &fdata))
 	} else {	
-		TIME_RUN_AC(t_algo,common_substrings(s, sn, r, mc, h, ml, callback, &ord));
+		TIME_RUN_AC(t_algo,common_substrings(s, sn, r, mc, h, ml, callback, cbdata));
+	}
+
+	if (cbdata == (void*) &td) {
+		topk_finish(&td);
+		cbdata = td.data;
+	}
+	if (cbdata == (void*) &ppd) postprocess_finish(&ppd);
+	/* closing also writes the end of the gzip stream: a full disk may only show there */
+	if ((ord.fp != stdout ? fclose(ord.fp) : fflush(ord.fp)) != 0) {
+		fprintf(stderr, "Could not write the output [%s]\n", strerror(errno));
+		exit(1);
 	}
 	
 	if (time) {
@@ -42,6 +42,12 @@ void output_findmaxrep(uint l, uint i, uint n, void* vout) {
 	out->a++;	// repeat counter
 }
 
+void output_reference(uint l, uint i, uint n, void* vout) {
+	output_readable_data* out = (output_readable_data*)vout;
+	fprintf(out->fp, "%u %u %u %u\n", l, out->r[i], i, i+n-1);
+	out->a++;	// repeat counter
+}
+
 void output_readable_po(uint l, uint i, uint n, void* vout) {
 	uint j;
 	output_readable_data* out = (output_readable_data*)vout;
@@ -51,6 +51,13 @@ void output_readable_po(uint l, uint i, uint n, void* out);
  */
 void output_findmaxrep(uint l, uint i, uint n, void* vout);
 
+/**
+ * Prints only references into the text: the repeat length, the text offset of
+ * its first occurrence and its suffix array interval, one repeat per line.
+ * Occurrences are recovered from the suffix array saved with -sa.
+ */
+void output_reference(uint l, uint i, uint n, void* vout);
+
 /* Also track positions */
 void output_readable_trac(uint l, uint i, uint n, void* out);
 
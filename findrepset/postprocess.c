@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "macros.h"
+#include "sorters.h"
+#include "postprocess.h"
+
+/** Map loading **/
+
+typedef struct pp_entry {
+	uint offset;
+	uint seq;
+	char* value;
+} pp_entry;
+
+#define ENTRY_KEY(x) (((uint64)(x)->offset << 32) | (x)->seq)
+static _def_qsort3(sort_entries, pp_entry, uint64, ENTRY_KEY, <)
+
+#define POS_VAL(x) (*(x))
+static _def_qsort3(sort_positions, uint, uint, POS_VAL, <)
+
+/* Reads "<offset>\t<value>\n" lines, sorted by offset. As with the std::map of
+ * the postprocessor, the last value written for an offset is the one kept. */
+static pp_entry* pp_load_map(const char* fn, uint* n) {
+	FILE* f = fopen(fn, "r");
+	pp_entry *res = NULL, *tmp;
+	uint m = 0, i, k;
+	char *line = NULL, *end;
+	size_t cap = 0;
+	ssize_t len;
+
+	if (!f) {
+		fprintf(stderr, "Could not open %s [%s]\n", fn, strerror(errno));
+		return NULL;
+	}
+	*n = 0;
+	while ((len = getline(&line, &cap, f)) > 0) {
+		if (line[len-1] == '\n') line[--len] = 0;
+		uint offset = strtoul(line, &end, 10);
+		if (end == line || *end != '\t') {
+			fprintf(stderr, "Unexpected line %u in %s\n", *n + 1, fn);
+			break;
+		}
+		if (*n == m) {
+			m = m ? 2*m : 1024;
+			tmp = (pp_entry*)pz_malloc(m*sizeof(pp_entry));
+			if (*n) memcpy(tmp, res, *n*sizeof(pp_entry));
+			if (res != NULL) pz_free(res);
+			res = tmp;
+		}
+		res[*n].offset = offset;
+		res[*n].seq = *n;
+		res[*n].value = strdup(end + 1);
+		(*n)++;
+	}
+	free(line);
+	fclose(f);
+
+	sort_entries(res, res + *n);
+	k = 0;
+	forn(i, *n) {
+		if (k && res[k-1].offset == res[i].offset) {
+			free(res[k-1].value);
+			k--;
+		}
+		res[k++] = res[i];
+	}
+	*n = k;
+	return res;
+}
+
+/* Index of the last start <= pos */
+static uint pp_find(uint* start, uint n, uint pos) {
+	uint lo = 0, hi = n;
+	while (hi - lo > 1) {
+		uint mid = lo + (hi - lo) / 2;
+		if (start[mid] <= pos) lo = mid;
+		else hi = mid;
+	}
+	return lo;
+}
+
+bool postprocess_init(postprocess_data* pp, uchar* s, uint* r, FILE* fp,
+	const char* charmap_file, const char* linemap_file, uint min_length,
+	bool skip_blank, bool skip_null) {
+	pp_entry* e;
+	uint i;
+
+	memset(pp, 0, sizeof(postprocess_data));
+	pp->s = s;
+	pp->r = r;
+	pp->fp = fp;
+	pp->min_length = min_length;
+	pp->skip_blank = skip_blank;
+	pp->skip_null = skip_null;
+
+	if (!(e = pp_load_map(charmap_file, &pp->nfiles)) || !pp->nfiles) return FALSE;
+	pp->file_start = (uint*)pz_malloc(pp->nfiles*sizeof(uint));
+	pp->file_name = (char**)pz_malloc(pp->nfiles*sizeof(char*));
+	forn(i, pp->nfiles) {
+		pp->file_start[i] = e[i].offset;
+		pp->file_name[i] = e[i].value;
+	}
+	pz_free(e);
+
+	if (!(e = pp_load_map(linemap_file, &pp->nlines)) || !pp->nlines) return FALSE;
+	pp->line_start = (uint*)pz_malloc(pp->nlines*sizeof(uint));
+	pp->line_number = (uint*)pz_malloc(pp->nlines*sizeof(uint));
+	forn(i, pp->nlines) {
+		pp->line_start[i] = e[i].offset;
+		pp->line_number[i] = strtoul(e[i].value, NULL, 10);
+		free(e[i].value);
+	}
+	pz_free(e);
+
+	pp->cgroups = 1024;
+	pp->groups = (pp_group*)pz_malloc(pp->cgroups*sizeof(pp_group));
+	memset(pp->groups, 0, pp->cgroups*sizeof(pp_group));
+	return TRUE;
+}
+
+/** JSON output, same format as the postprocessor **/
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static void pp_write_escaped(FILE* fp, uchar* t, uint l) {
+	uint j;
+	fputc('"', fp);
+	forn(j, l) {
+		switch (t[j]) {
+			case '"': fputs("\\\"", fp); break;
+			case '\\': fputs("\\\\", fp); break;
+			case '\b': fputs("\\b", fp); break;
+			case '\f': fputs("\\f", fp); break;
+			case '\n': fputs("\\n", fp); break;
+			case '\r': fputs("\\r", fp); break;
+			case '\t': fputs("\\t", fp); break;
+			default:
+				if (t[j] < 0x80 && isprint(t[j])) {
+					fputc(t[j], fp);
+				} else {
+					fputs("\\\\x", fp);
+					fputc(hex_digits[t[j] >> 4], fp);
+					fputc(hex_digits[t[j] & 0xf], fp);
+				}
+		}
+	}
+	fputc('"', fp);
+}
+
+static uint pp_line(postprocess_data* pp, uint pos) {
+	return pp->line_number[pp_find(pp->line_start, pp->nlines, pos)];
+}
+
+static void pp_write_record(postprocess_data* pp, uchar* t, uint l, uint* pos, uint npos) {
+	uint j;
+	if (pp->a) fputc('\n', pp->fp);
+	fputs("{\"text\": ", pp->fp);
+	pp_write_escaped(pp->fp, t, l);
+	fputs(",\"locations\": [", pp->fp);
+	forn(j, npos) {
+		if (j) fputc(',', pp->fp);
+		fprintf(pp->fp, "{\"path\":\t\"%s\",\t\"start_line\": %u,\t\"end_line\":\t%u}",
+			pp->file_name[pp_find(pp->file_start, pp->nfiles, pos[j])],
+			pp_line(pp, pos[j]), pp_line(pp, pos[j] + l - 1));
+	}
+	fputs("]}", pp->fp);
+	pp->a++;
+}
+
+/** Grouping of fragments **/
+
+static uint64 pp_hash(uchar* t, uint l) {
+	uint64 h = 14695981039346656037ULL;
+	uint j;
+	forn(j, l) h = (h ^ t[j]) * 1099511628211ULL;
+	return h;
+}
+
+static pp_group* pp_lookup(postprocess_data* pp, uint offset, uint length) {
+	uchar* t = pp->s + offset;
+	uint64 h = pp_hash(t, length);
+	uint k = h & (pp->cgroups - 1), j;
+	pp_group* g;
+
+	for (;; k = (k + 1) & (pp->cgroups - 1)) {
+		g = &pp->groups[k];
+		if (!g->length) break;
+		if (g->hash == h && g->length == length && !memcmp(pp->s + g->offset, t, length)) return g;
+	}
+
+	if (2 * (pp->ngroups + 1) > pp->cgroups) {	// keep the table at most half full
+		pp_group* old = pp->groups;
+		uint cold = pp->cgroups;
+		pp->cgroups *= 2;
+		pp->groups = (pp_group*)pz_malloc(pp->cgroups*sizeof(pp_group));
+		memset(pp->groups, 0, pp->cgroups*sizeof(pp_group));
+		forn(j, cold) if (old[j].length) {
+			for (k = old[j].hash & (pp->cgroups - 1); pp->groups[k].length; k = (k + 1) & (pp->cgroups - 1));
+			pp->groups[k] = old[j];
+		}
+		pz_free(old);
+		for (k = h & (pp->cgroups - 1); pp->groups[k].length; k = (k + 1) & (pp->cgroups - 1));
+		g = &pp->groups[k];
+	}
+
+	g->hash = h;
+	g->offset = offset;
+	g->length = length;
+	pp->ngroups++;
+	return g;
+}
+
+static void pp_add_position(pp_group* g, uint pos) {
+	if (g->npos == g->cpos) {
+		g->cpos = g->cpos ? 2*g->cpos : 4;
+		g->pos = (uint*)realloc(g->pos, g->cpos*sizeof(uint));
+	}
+	g->pos[g->npos++] = pos;
+}
+
+static bool pp_skip(postprocess_data* pp, uchar* t, uint l) {
+	uint j;
+	if (l <= pp->min_length) return TRUE;
+	if (pp->skip_blank) {
+		forn(j, l) if (!(t[j] < 0x80 && (isblank(t[j]) || iscntrl(t[j])))) break;
+		if (j == l) return TRUE;
+	}
+	if (pp->skip_null) {
+		forn(j, l) if (t[j]) break;
+		if (j == l) return TRUE;
+	}
+	return FALSE;
+}
+
+/* Whether the occurrence at pos crosses the end of its file */
+static bool pp_is_split(postprocess_data* pp, uint pos, uint l) {
+	uint f = pp_find(pp->file_start, pp->nfiles, pos);
+	return f + 1 < pp->nfiles && pos + l > pp->file_start[f+1];
+}
+
+void output_postprocessed(uint l, uint i, uint n, void* vpp) {
+	postprocess_data* pp = (postprocess_data*)vpp;
+	uint j, pos, rem, size, f;
+	bool split = FALSE;
+
+	forn(j, n) if (pp_is_split(pp, pp->r[i+j], l)) {
+		split = TRUE;
+		break;
+	}
+
+	if (!split) {
+		uchar* t = pp->s + pp->r[i];
+		if (n > 1 && !pp_skip(pp, t, l)) {
+			pp_write_record(pp, t, l, pp->r + i, n);
+			pp_lookup(pp, pp->r[i], l)->whole = TRUE;
+		}
+		return;
+	}
+
+	forn(j, n) {
+		pos = pp->r[i+j];
+		rem = l;
+		f = pp_find(pp->file_start, pp->nfiles, pos);
+		do {
+			if (f + 1 >= pp->nfiles || pos + rem <= pp->file_start[f+1]) {
+				size = rem;
+			} else {
+				size = pp->file_start[f+1] - pos;
+			}
+			if (!pp_skip(pp, pp->s + pos, size)) pp_add_position(pp_lookup(pp, pos, size), pos);
+			pos += size;
+			rem -= size;
+			f++;
+		} while (rem);
+	}
+}
+
+void postprocess_finish(postprocess_data* pp) {
+	uint i, j, k;
+	forn(i, pp->cgroups) {
+		pp_group* g = &pp->groups[i];
+		if (g->length && !g->whole && g->npos > 1) {
+			sort_positions(g->pos, g->pos + g->npos);
+			k = 1;
+			forsn(j, 1, g->npos) if (g->pos[j] != g->pos[k-1]) g->pos[k++] = g->pos[j];
+			if (k > 1) pp_write_record(pp, pp->s + g->offset, g->length, g->pos, k);
+		}
+		free(g->pos);
+	}
+	pz_free(pp->groups);
+	forn(i, pp->nfiles) free(pp->file_name[i]);
+	pz_free(pp->file_start);
+	pz_free(pp->file_name);
+	pz_free(pp->line_start);
+	pz_free(pp->line_number);
+}
@@ -0,0 +1,77 @@
+#ifndef __POSTPROCESS_H__
+#define __POSTPROCESS_H__
+
+#include "tipos.h"
+#include <stdio.h>
+#include "output_callbacks.h"
+
+/**
+ * In-process postprocessing
+ *
+ * Does the work of the postprocessor directly inside the output callback:
+ * repeats are split at the file boundaries of the preprocessor's charmap,
+ * their positions are resolved to lines with the linemap, and the final JSON
+ * records are written without the intermediate findmaxrep text output.
+ *
+ * Repeats with no occurrence crossing a file boundary are written as soon as
+ * they are found. Fragments of split repeats are grouped by text in a hash
+ * table (by reference into s) and written by postprocess_finish, unless a
+ * whole repeat with the same text was already written: every occurrence of
+ * that text is then already part of that record.
+ */
+
+typedef struct pp_group {
+	uint64 hash;
+	uint offset;	/* text of the group is s[offset..offset+length) */
+	uint length;
+	bool whole;		/* already written as a whole repeat */
+	uint* pos;
+	uint npos, cpos;
+} pp_group;
+
+typedef struct postprocess_data {
+	uchar* s;
+	uint* r;
+	FILE* fp;
+
+	/* skip rules of the postprocessor */
+	uint min_length;	/* pieces of this length or less are skipped */
+	bool skip_blank;
+	bool skip_null;
+
+	/* charmap: files[k] starts at file_start[k], the last entry is the end */
+	uint nfiles;
+	uint* file_start;
+	char** file_name;
+
+	/* linemap: line_number[k] starts at line_start[k] */
+	uint nlines;
+	uint* line_start;
+	uint* line_number;
+
+	/* fragments of split repeats, open addressing */
+	pp_group* groups;
+	uint ngroups, cgroups;
+
+	int a;	/* records written */
+} postprocess_data;
+
+/**
+ * Loads the charmap and linemap written by the preprocessor.
+ * Returns FALSE (after reporting the problem) if they can not be read.
+ */
+bool postprocess_init(postprocess_data* pp, uchar* s, uint* r, FILE* fp,
+	const char* charmap_file, const char* linemap_file, uint min_length,
+	bool skip_blank, bool skip_null);
+
+/**
+ * The output_callback, with a postprocess_data as extra data
+ */
+void output_postprocessed(uint l, uint i, uint n, void* vpp);
+
+/**
+ * Writes the grouped fragments and releases the maps
+ */
+void postprocess_finish(postprocess_data* pp);
+
+#endif // __POSTPROCESS_H__
@@ -0,0 +1,84 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "topk.h"
+
+void topk_init(topk_data* td, uint k, uint key, uint64 min_score,
+	output_callback* callback, void* data) {
+	td->data = data;
+	td->callback = callback;
+	td->key = key;
+	td->k = k;
+	td->min_score = min_score;
+	td->heap = k ? (topk_entry*)pz_malloc(k*sizeof(topk_entry)) : NULL;
+	td->size = 0;
+}
+
+/* Order of the heap: lower score first, then the later suffix array interval
+ * so that ties are resolved in favour of the first repeats found */
+static inline bool topk_less(topk_entry* a, topk_entry* b) {
+	return a->score < b->score || (a->score == b->score && a->i > b->i);
+}
+
+static void topk_sift_down(topk_entry* heap, uint size, uint j) {
+	topk_entry e = heap[j];
+	uint c;
+	while ((c = 2*j + 1) < size) {
+		if (c + 1 < size && topk_less(&heap[c+1], &heap[c])) c++;
+		if (!topk_less(&heap[c], &e)) break;
+		heap[j] = heap[c];
+		j = c;
+	}
+	heap[j] = e;
+}
+
+static void topk_sift_up(topk_entry* heap, uint j) {
+	topk_entry e = heap[j];
+	while (j > 0 && topk_less(&e, &heap[(j-1)/2])) {
+		heap[j] = heap[(j-1)/2];
+		j = (j-1)/2;
+	}
+	heap[j] = e;
+}
+
+void topk_callback(uint l, uint i, uint n, void* tdata) {
+	topk_data* td = (topk_data*)tdata;
+	topk_entry e;
+
+	e.l = l;
+	e.i = i;
+	e.n = n;
+	switch (td->key) {
+		case TOPK_LENGTH: e.score = l; break;
+		case TOPK_OCCURRENCES: e.score = n; break;
+		default: e.score = (uint64)l * n;
+	}
+	if (e.score < td->min_score) return;
+
+	if (!td->k) {
+		td->callback(l, i, n, td->data);
+	} else if (td->size < td->k) {
+		td->heap[td->size] = e;
+		topk_sift_up(td->heap, td->size++);
+	} else if (topk_less(&td->heap[0], &e)) {
+		td->heap[0] = e;
+		topk_sift_down(td->heap, td->size, 0);
+	}
+}
+
+void topk_finish(topk_data* td) {
+	uint j;
+	if (!td->k) return;
+	/* heap sort: repeatedly moving the minimum to the end leaves the best first */
+	for (j = td->size; j > 1; j--) {
+		topk_entry e = td->heap[0];
+		td->heap[0] = td->heap[j-1];
+		td->heap[j-1] = e;
+		topk_sift_down(td->heap, j-1, 0);
+	}
+	forn(j, td->size) td->callback(td->heap[j].l, td->heap[j].i, td->heap[j].n, td->data);
+	pz_free(td->heap);
+	td->heap = NULL;
+	td->size = 0;
+}
@@ -0,0 +1,44 @@
+#ifndef __TOPK_H__
+#define __TOPK_H__
+
+#include "tipos.h"
+#include "output_callbacks.h"
+
+/* Keys to rank repeats with */
+#define TOPK_LENGTH 0
+#define TOPK_OCCURRENCES 1
+#define TOPK_SCORE 2	/* length * occurrences */
+
+typedef struct topk_entry {
+	uint64 score;
+	uint l, i, n;
+} topk_entry;
+
+typedef struct topk_data {
+	void* data;
+	output_callback* callback;
+	uint key;
+	uint k;				/* 0 keeps every repeat reaching min_score */
+	uint64 min_score;
+	topk_entry* heap;	/* min-heap on the score of the k best repeats so far */
+	uint size;
+} topk_data;
+
+/**
+ * Top-K Filter Callback
+ *
+ * An output_callback wrapper that keeps only the k best repeats according to
+ * key, and only those scoring at least min_score, using a bounded heap. They
+ * are passed to the next callback by topk_finish, best first, once the
+ * enumeration is over (the suffix array must still be valid then). Without a
+ * bound k, repeats reaching min_score are passed on immediately.
+ */
+
+void topk_init(topk_data* td, uint k, uint key, uint64 min_score,
+	output_callback* callback, void* data);
+
+void topk_callback(uint l, uint i, uint n, void* tdata);
+
+void topk_finish(topk_data* td);
+
+#endif // __TOPK_H__
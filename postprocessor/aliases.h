@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "../util/mappedfile.h"
+#include "positionmap.h"
+
+// Files left out of the concat by the preprocessor (--aliases) for having the same content as a file kept in it: the
+// paths of those copies, by charmap entry of the file kept. Every location in a kept file is also a location in each
+// of its copies, at the same lines.
+class Aliases {
+private:
+    std::unordered_map<size_t, std::vector<std::string>> paths;
+    static inline const std::vector<std::string> none;
+
+public:
+    Aliases() = default;
+
+    // reads the "<offset of the file kept>\t<path>" lines of an alias table
+    Aliases(const std::string &path, const CharMap &charmap) {
+        MappedFile file(path, MADV_SEQUENTIAL);
+        read_text_map(file.view(), path, [&](unsigned long offset, std::string_view alias) {
+            paths[charmap.find(offset)].emplace_back(alias);
+        });
+    }
+
+    bool empty() const { return paths.empty(); }
+
+    // the copies of the file of the given charmap entry
+    const std::vector<std::string> &of(size_t file) const {
+        auto it = paths.find(file);
+        return it == paths.end() ? none : it->second;
+    }
+
+    // the charmap entries of the files with copies, in order
+    std::vector<size_t> files() const {
+        std::vector<size_t> files;
+        for (const auto &entry : paths) files.push_back(entry.first);
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <string_view>
+#include <vector>
+#include "positionmap.h"
+#include "repeatgroups.h"
+
+// a location of a clone class: a line range of one file, with the concat positions of its first and last characters
+struct ClassLocation {
+    unsigned long start_pos;
+    unsigned long end_pos;
+    unsigned int start_line;
+    unsigned int end_line;
+};
+
+// repeats whose occurrences overlap, directly or through each other, with the line ranges they cover. The text is
+// the longest of the repeats.
+struct CloneClass {
+    std::string_view text;
+    std::vector<ClassLocation> locations;
+};
+
+// Consolidates repeats into clone classes: the occurrences of a repeat belong to one class, and occurrences sharing
+// characters of the same file join their classes through a union-find. Occurrences merely sharing a line do not, or
+// short repeats next to unrelated code on a line would chain whole trees into one class. Occurrences are sorted by file
+// and position and swept once, each run of overlapping occurrences becoming one location of its class, over the lines
+// it spans. Classes come in the order of their first repeat, and only those left with more than one location are
+// returned.
+inline std::vector<CloneClass> consolidate_classes(const RepeatTable &repeats, const CharMap &charmap,
+                                                   const LineMap &linemap) {
+    struct Occurrence {
+        uint32_t file;
+        unsigned int start_line;
+        unsigned int end_line;
+        uint32_t repeat;
+        unsigned long start_pos;
+        unsigned long end_pos;
+    };
+
+    std::vector<Occurrence> occurrences;
+    for (uint32_t r = 0; r < repeats.size(); r++) {
+        size_t length = repeats.text(r).size();
+        for (unsigned long pos : repeats.positions_of(r)) {
+            unsigned long end = pos + length - 1;
+            occurrences.push_back({(uint32_t) charmap.find(pos), linemap.at(pos), linemap.at(end), r, pos, end});
+        }
+    }
+    std::sort(occurrences.begin(), occurrences.end(), [](const Occurrence &a, const Occurrence &b) {
+        if (a.file != b.file) return a.file < b.file;
+        return a.start_pos < b.start_pos;
+    });
+
+    std::vector<uint32_t> parent(repeats.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&parent](uint32_t r) {
+        while (parent[r] != r) r = parent[r] = parent[parent[r]];
+        return r;
+    };
+
+    // runs of overlapping occurrences, in sorted order, and the repeat of their first occurrence
+    std::vector<ClassLocation> runs;
+    std::vector<uint32_t> run_repeats;
+    for (size_t i = 0; i < occurrences.size(); i++) {
+        const Occurrence &occ = occurrences[i];
+        if (!runs.empty() && occurrences[i - 1].file == occ.file && occ.start_pos <= runs.back().end_pos) {
+            ClassLocation &run = runs.back();
+            run.end_line = std::max(run.end_line, occ.end_line);
+            run.end_pos = std::max(run.end_pos, occ.end_pos);
+            parent[find(occ.repeat)] = find(run_repeats.back());
+            continue;
+        }
+        runs.push_back({occ.start_pos, occ.end_pos, occ.start_line, occ.end_line});
+        run_repeats.push_back(occ.repeat);
+    }
+    std::vector<Occurrence>().swap(occurrences);
+
+    // classes numbered in the order of their first repeat, named after their longest one
+    std::vector<uint32_t> class_of(repeats.size(), UINT32_MAX);
+    std::vector<CloneClass> classes;
+    for (uint32_t r = 0; r < repeats.size(); r++) {
+        uint32_t &c = class_of[find(r)];
+        if (c == UINT32_MAX) {
+            c = classes.size();
+            classes.push_back({repeats.text(r), {}});
+        } else if (repeats.text(r).size() > classes[c].text.size()) {
+            classes[c].text = repeats.text(r);
+        }
+    }
+    for (size_t i = 0; i < runs.size(); i++) {
+        classes[class_of[find(run_repeats[i])]].locations.push_back(runs[i]);
+    }
+
+    classes.erase(std::remove_if(classes.begin(), classes.end(), [](const CloneClass &c) {
+        return c.locations.size() < 2;
+    }), classes.end());
+    return classes;
+}
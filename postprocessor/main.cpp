@@ -1,56 +1,171 @@
 #include <iostream>
 #include <algorithm>
+#include <array>
 #include <unordered_set>
+#include <unordered_map>
 #include <optional>
-#include "../util/stringescape.h"
+#include <thread>
+#include "../util/jsonwriter.h"
 #include "../util/ArgParser.h"
-#include "zlib/zstr.hpp"
+#include "../util/linepipeline.h"
+#include "../util/pgzipstream.h"
+#include "aliases.h"
+#include "reference.h"
+#include "repeatreader.h"
+#include "protobuf.h"
+#include "repeatgroups.h"
+#include "positionmap.h"
+#include "cloneclasses.h"
+#include "nestedrepeats.h"
 
 namespace fs = std::filesystem;
 
-using path = std::string;
-using Repeats = std::unordered_map<path, std::unordered_set<unsigned long>>;
-using CharMap = std::map<unsigned long, std::string>;
-
 struct ProcessingOptions {
     int min_repeat_length;
     bool skip_blank_repeats;
     bool skip_null_repeats;
     bool compress;
+    bool protobuf;
     std::string bwt_file;
     std::string json_file;
+    std::optional<std::vector<std::string>> reference;   // concat and suffix array files for -ref input
+    bool stream;
+    unsigned threads;
+    bool classes;   // consolidate overlapping repeats into clone classes
+    bool drop_nested;   // drop repeats whose occurrences all lie inside occurrences of longer ones
+    std::optional<std::vector<std::string>> aliases;   // alias table and concat files for --aliases input
 };
 
+// fixed, so that the output does not depend on the number of threads
+const size_t group_shards = 256;
+
+
+// writes a location of a repeat, then the same location in each copy of its file
+void emit_verbose_location(JsonWriter &json_out, std::string_view filename, const std::vector<std::string> &copies,
+                           unsigned int start_line, unsigned int end_line, bool &print_separator) {
+    for (size_t i = 0; i <= copies.size(); i++) {
+        if (print_separator) json_out.raw(',');
+        json_out.raw("{\"path\":\t\"").raw(i ? std::string_view(copies[i - 1]) : filename).raw("\",\t");
+        json_out.raw("\"start_line\": ").number(start_line).raw(",\t");
+        json_out.raw("\"end_line\":\t").number(end_line).raw('}');
+        print_separator = true;
+    }
+}
 
+template<typename Positions>
 void
-emit_verbose_repeat(std::ostream &json_out, const std::string &subtext, const std::unordered_set<unsigned long> &positions,
+emit_verbose_repeat(JsonWriter &json_out, std::string_view subtext, const Positions &positions,
                     const CharMap &charmap,
-                    const std::map<unsigned long, unsigned long> &linemap) {
-    json_out << "{\"text\": ";
-    write_escaped_string(json_out, subtext);
-    json_out << ",\"locations\": [";
+                    const LineMap &linemap, const Aliases &aliases) {
+    json_out.raw("{\"text\": ").string(subtext).raw(",\"locations\": [");
     bool print_separator = false;
-    
- 
-    for (unsigned long start_pos : positions) {
-        if (print_separator) json_out << ",";
 
-        std::string filename = (--charmap.upper_bound(start_pos))->second;
-        auto start_line = (--linemap.upper_bound(start_pos))->second;
-        json_out << "{\"path\":\t\"" << filename << "\",\t";
-        json_out << "\"start_line\": " << start_line << ",\t";
+    for (unsigned long start_pos : positions) {
+        size_t file = charmap.find(start_pos);
+        auto start_line = linemap.at(start_pos);
         unsigned long end_pos = start_pos + subtext.length() - 1; // if length == 1, end_pos == start_pos
-        auto end_line = (--linemap.upper_bound(end_pos))->second;
-        json_out << "\"end_line\":\t" << end_line << "}";
-        print_separator = true;
+        auto end_line = linemap.at(end_pos);
+        emit_verbose_location(json_out, charmap.value(file), aliases.of(file), start_line, end_line, print_separator);
     }
 
-    json_out << "]}";
+    json_out.raw("]}");
 }
 
+template<typename Positions>
+void
+emit_protobuf_repeat(protobuf::RepeatWriter &writer, std::string_view subtext, const Positions &positions,
+                     const CharMap &charmap, const LineMap &linemap, const Aliases &aliases) {
+    writer.begin(subtext);
 
+    for (unsigned long start_pos : positions) {
+        size_t file = charmap.find(start_pos);
+        auto start_line = linemap.at(start_pos);
+        unsigned long end_pos = start_pos + subtext.length() - 1;
+        auto end_line = linemap.at(end_pos);
+        writer.add_position(start_pos, start_pos - charmap.offset(file), charmap.value(file), start_line, end_line);
+        for (const std::string &copy : aliases.of(file)) {
+            // the copies are not in the concat, their positions are those of the file kept
+            writer.add_position(start_pos, start_pos - charmap.offset(file), copy, start_line, end_line);
+        }
+    }
+
+    writer.end();
+}
 
-bool should_skip(std::string &text, const ProcessingOptions &opts){
+// a clone class is written as a repeat of its text, with one location per line range
+void emit_verbose_class(JsonWriter &json_out, const CloneClass &clone_class, const CharMap &charmap,
+                        const Aliases &aliases) {
+    json_out.raw("{\"text\": ").string(clone_class.text).raw(",\"locations\": [");
+    bool print_separator = false;
+
+    for (const ClassLocation &loc : clone_class.locations) {
+        size_t file = charmap.find(loc.start_pos);
+        emit_verbose_location(json_out, charmap.value(file), aliases.of(file), loc.start_line, loc.end_line,
+                              print_separator);
+    }
+
+    json_out.raw("]}");
+}
+
+void emit_protobuf_class(protobuf::RepeatWriter &writer, const CloneClass &clone_class, const CharMap &charmap,
+                         const Aliases &aliases) {
+    writer.begin(clone_class.text);
+
+    for (const ClassLocation &loc : clone_class.locations) {
+        size_t file = charmap.find(loc.start_pos);
+        writer.add_position(loc.start_pos, loc.start_pos - charmap.offset(file), charmap.value(file),
+                            loc.start_line, loc.end_line);
+        for (const std::string &copy : aliases.of(file)) {
+            writer.add_position(loc.start_pos, loc.start_pos - charmap.offset(file), copy,
+                                loc.start_line, loc.end_line);
+        }
+    }
+
+    writer.end();
+}
+
+// appends repeats to a buffer in the output format selected by the options
+class RepeatEmitter {
+private:
+    JsonWriter json_writer;
+    const CharMap &charmap;
+    const LineMap &linemap;
+    const Aliases &aliases;
+    bool protobuf;
+    protobuf::RepeatWriter pb_writer;
+    bool print_obj_separator = false;
+
+public:
+    RepeatEmitter(std::string &out, const CharMap &charmap, const LineMap &linemap, const Aliases &aliases,
+                  bool protobuf)
+            : json_writer(out), charmap(charmap), linemap(linemap), aliases(aliases), protobuf(protobuf),
+              pb_writer(out) {}
+
+    template<typename Positions>
+    void emit(std::string_view subtext, const Positions &positions) {
+        if (protobuf) {
+            emit_protobuf_repeat(pb_writer, subtext, positions, charmap, linemap, aliases);
+            return;
+        }
+        if (print_obj_separator) json_writer.raw('\n');
+        emit_verbose_repeat(json_writer, subtext, positions, charmap, linemap, aliases);
+        print_obj_separator = true;
+    }
+
+    void emit(const CloneClass &clone_class) {
+        if (protobuf) {
+            emit_protobuf_class(pb_writer, clone_class, charmap, aliases);
+            return;
+        }
+        if (print_obj_separator) json_writer.raw('\n');
+        emit_verbose_class(json_writer, clone_class, charmap, aliases);
+        print_obj_separator = true;
+    }
+};
+
+
+
+bool should_skip(std::string_view text, const ProcessingOptions &opts){
    bool skip = (text.size() <= opts.min_repeat_length) ||
                         (opts.skip_blank_repeats && std::all_of(text.begin(), text.end(), [](char c) {
                             return std::isblank(c) || std::iscntrl(c);
@@ -61,96 +176,95 @@ bool should_skip(std::string &text, const ProcessingOptions &opts){
 }
 
 
+// adds the occurrence at pos to the groups, split at the end of each file it spans.
+// fp is the fingerprint of the whole subtext, only pieces of split occurrences need hashing.
 void
-process_position(const CharMap &charmap, Repeats &repeats, std::string subtext, unsigned long pos, const ProcessingOptions &opts) {
+process_position(const CharMap &charmap, GroupBatch &groups, std::string_view subtext, const Fingerprint &fp,
+                 bool copy, unsigned long pos, const ProcessingOptions &opts) {
     unsigned long repeat_end = pos + subtext.size() - 1;
-    auto it = --charmap.upper_bound(pos);
+    size_t file = charmap.find(pos);
+    bool whole = true;
 
     do {
-        // name of the source file where the start of the repeat is found
-        const std::string &source_file = it->second;
-        it++;
         // beginning of the next file after the start of the repeat
-        unsigned long file_end = it->first - 1;
-        std::string repeat_subtext;
+        file++;
 
-        if (it == charmap.end() || repeat_end <= file_end) {
+        if (file == charmap.size() || repeat_end <= charmap.offset(file) - 1) {
             // there is no next file, or the repeat fits in the current file -> no more processing required
-            repeat_subtext = std::move(subtext);
-            subtext.clear();
-            if (!should_skip(repeat_subtext, opts)) {
-                repeats[repeat_subtext].insert(pos);
-            }    
-        } else {
-            // the repeated sequence spans multiple files -> split it
-            unsigned long actual_size = file_end - pos + 1;
-            repeat_subtext = subtext.substr(0, actual_size);
-            subtext = subtext.substr(actual_size);
-            if (!should_skip(repeat_subtext, opts)) {
-                repeats[repeat_subtext].insert(pos);
+            if (!should_skip(subtext, opts)) {
+                groups.add(whole ? fp : fingerprint(subtext), subtext, copy, pos);
             }
-            pos += actual_size;
-        }
-    } while (!subtext.empty());
-}
-
-// custom extractor for objects of type RepeatEntry
-void
-read(std::istream &is, Repeats &repeats, const CharMap &charmap, const ProcessingOptions &opts) {
-    std::istream::sentry s(is);
-    std::string line;
-
-    if (s) {
-        std::getline(is, line, ':');
-
-        if (line != "Repeat size") {
-            throw std::runtime_error("Expected repeat size in first Repeat line");
-        }
-
-        unsigned long repeat_size;
-        is >> repeat_size;
-        std::getline(is, line); // discard rest of line
-        std::getline(is, line, ':');
-
-        if (line != "Number of occurrences") {
-            throw std::runtime_error("Expected number of occurrences in second Repeat line");
+            break;
         }
 
-        unsigned long repeat_occurrences;
-        is >> repeat_occurrences;
-        std::getline(is, line); // discard rest of line
-        std::getline(is, line, ':');
-
-        if (line != "Repeat subtext") {
-            throw std::runtime_error("Expected repeat subtext in third Repeat line");
+        // the repeated sequence spans multiple files -> split it
+        unsigned long actual_size = charmap.offset(file) - pos;
+        std::string_view repeat_subtext = subtext.substr(0, actual_size);
+        if (!should_skip(repeat_subtext, opts)) {
+            groups.add(fingerprint(repeat_subtext), repeat_subtext, copy, pos);
         }
+        subtext.remove_prefix(actual_size);
+        pos += actual_size;
+        whole = false;
+    } while (!subtext.empty());
+}
 
-        is.get();   // discard the space immediately after
-        char subtext[repeat_size];
-        is.read(subtext, repeat_size);
-        std::string repeat_subtext(subtext, repeat_size);
-        std::getline(is, line);    // get rid of the end of the line
-        std::getline(is, line, ':');
-
-        if (line != "Suffix array interval of this repeat") {
-            throw std::runtime_error("Expected suffix array interval in fourth Repeat line");
-        }
+// whether the occurrence at pos continues past the end of its file
+bool is_split(const CharMap &charmap, unsigned long pos, unsigned long length) {
+    size_t next_file = charmap.find(pos) + 1;
+    return next_file < charmap.size() && pos + length > charmap.offset(next_file);
+}
 
-        std::getline(is, line);    // discard suffix array interval
-        std::getline(is, line, ':');
+// whether the occurrence at pos starts at the start of its file or ends at its end, as the fragments of split
+// occurrences do
+bool touches_file_end(const CharMap &charmap, unsigned long pos, unsigned long length) {
+    size_t file = charmap.find(pos);
+    return pos == charmap.offset(file) || (file + 1 < charmap.size() && pos + length == charmap.offset(file + 1));
+}
 
-        if (line != "Text positions of this repeat") {
-            throw std::runtime_error("Expected text positions in fifth Repeat line");
+// Splits the occurrences of the repeats read from one block of input at file ends, and adds them to the shared groups.
+// In streaming mode, repeats with no occurrence crossing a file end are emitted as soon as they are read, and only
+// the fragments of split repeats are kept until the end. A fragment group whose text was already emitted as a whole
+// repeat is dropped: findrepset reports every occurrence of a repeat, so that record already has all its positions.
+// Such a repeat has an occurrence where a fragment is, touching a file end, and only those repeats are remembered.
+class RepeatCollector {
+private:
+    const CharMap &charmap;
+    const ProcessingOptions &opts;
+    RepeatEmitter &emitter;
+    GroupBatch batch;
+
+public:
+    RepeatCollector(const CharMap &charmap, const ProcessingOptions &opts, RepeatEmitter &emitter,
+                    ShardedGroups &groups)
+            : charmap(charmap), opts(opts), emitter(emitter), batch(groups) {}
+
+    // a subtext that is not copied must remain valid until the groups are written
+    void add(std::string_view subtext, bool copy, const std::vector<unsigned long> &positions) {
+        Fingerprint fp = fingerprint(subtext);
+
+        if (opts.stream && std::none_of(positions.begin(), positions.end(), [&](unsigned long pos) {
+            return is_split(charmap, pos, subtext.size());
+        })) {
+            if (positions.size() > 1 && !should_skip(subtext, opts)) {
+                emitter.emit(subtext, positions);
+                if (std::any_of(positions.begin(), positions.end(), [&](unsigned long pos) {
+                    return touches_file_end(charmap, pos, subtext.size());
+                })) {
+                    batch.add_emitted(fp);
+                }
+            }
+            return;
         }
 
-        for (unsigned long i = 0; i < repeat_occurrences; i++) {
-            unsigned long pos;
-            is >> pos;
-            
-            process_position(charmap, repeats, repeat_subtext, pos, opts);
+        if (copy) subtext = batch.hold(subtext);
+        for (unsigned long pos : positions) {
+            process_position(charmap, batch, subtext, fp, copy, pos, opts);
         }
     }
-}
+
+    void flush() { batch.flush(); }
+};
 
 
 int main(int argc, char **argv) {
@@ -167,43 +281,20 @@ int main(int argc, char **argv) {
     std::string linemap_file = argv[3];
     std::string json_file = argv[4];
 
-    std::ifstream charmap_in(charmap_file);
-
-    if (!charmap_in) {
-        std::cerr << "charmap file open fails. exit.\n";
+    CharMap charmap;
+    LineMap linemap;
+    try {
+        charmap = load_charmap(charmap_file);
+    } catch (std::exception &e) {
+        std::cerr << "charmap file open fails: " << e.what() << ". exit.\n";
         exit(1);
     }
-
-    std::map<unsigned long, std::string> charmap;
-    std::string line;
-    unsigned long char_idx;
-
-    while (charmap_in >> char_idx) {
-        if (charmap_in.rdbuf()->sbumpc() != '\t') {
-            std::cerr << "Unexpected character at position " << charmap_in.tellg() << " in " << charmap_file;
-            break;
-        }
-        std::getline(charmap_in, line);
-        charmap[char_idx] = line;
-    }
-
-    charmap_in.close();
-
-    std::map<unsigned long, unsigned long> linemap;
-
-    std::ifstream linemap_in(linemap_file);
-    if (!linemap_in) {
-        std::cerr << "linemap output file open fails. exit.\n";
+    try {
+        linemap = load_linemap(linemap_file);
+    } catch (std::exception &e) {
+        std::cerr << "linemap file open fails: " << e.what() << ". exit.\n";
         exit(1);
     }
-    while (linemap_in >> char_idx) {
-        if (linemap_in.rdbuf()->sbumpc() != '\t') {
-            std::cerr << "Unexpected character at position " << linemap_in.tellg() << " in " << linemap_file;
-            break;
-        }
-        std::getline(linemap_in, line);
-        linemap[char_idx] = std::stoul(line);
-    }
 
     std::unordered_set<std::string> splits;
     ProcessingOptions opts{
@@ -211,48 +302,197 @@ int main(int argc, char **argv) {
             args.cmdOptionExists("--skip-blank"),
             args.cmdOptionExists("--skip-null"),
             args.cmdOptionExists("--compress"),
+            args.cmdOptionExists("--protobuf"),
             bwt_file,
-            json_file
+            json_file,
+            args.getCmdArgs("--reference"),
+            // classes and nesting are decided across all the repeats, none can be written before the end
+            args.cmdOptionExists("--stream") && !args.cmdOptionExists("--classes") &&
+            !args.cmdOptionExists("--drop-nested"),
+            (unsigned) std::stoul(args.getCmdArg("-j").value_or(
+                    std::to_string(std::max(1u, std::thread::hardware_concurrency())))),
+            args.cmdOptionExists("--classes"),
+            args.cmdOptionExists("--drop-nested"),
+            args.getCmdArgs("--aliases")
     };
 
-    // first pass: colecting repeats splitting if necessary
-    Repeats repeats;
-
-    std::unique_ptr<std::istream> bwtp(
-            opts.compress ? (std::istream *) new zstr::ifstream(opts.bwt_file) : new std::ifstream(opts.bwt_file));
-    std::istream &bwt_in = *bwtp;
+    if (opts.reference && opts.reference->size() != 2) {
+        std::cerr << "--reference expects the concatenated file and the suffix array file. exit.\n";
+        exit(1);
+    }
 
-    if (!bwt_in) {
-        std::cerr << "bwt input file open fails. exit.\n";
+    if (opts.aliases && opts.aliases->size() != 2) {
+        std::cerr << "--aliases expects the alias table and the concatenated file. exit.\n";
         exit(1);
     }
-    try {
-        while (bwt_in) {
-            read(bwt_in, repeats, charmap, opts);
+
+    Aliases aliases;
+    std::optional<MappedFile> concat;   // the text of the files with copies
+    if (opts.aliases) {
+        try {
+            aliases = Aliases((*opts.aliases)[0], charmap);
+            concat.emplace((*opts.aliases)[1], MADV_RANDOM);
+        } catch (std::exception &e) {
+            std::cerr << "alias input file open fails: " << e.what() << ". exit.\n";
+            exit(1);
         }
-    } catch (std::runtime_error &e) {
-        std::cerr << "Failed to read repeat entry at position " << bwt_in.tellg() << " in " << opts.bwt_file << ": "
-                  << e.what();
     }
-    
-    // preparation for second pass
+
     std::unique_ptr<std::ostream> json_outp(
-            opts.compress ? (std::ostream *) new zstr::ofstream(opts.json_file) : new std::ofstream(opts.json_file));
+            opts.compress ? (std::ostream *) new pgzstr::ofstream(opts.json_file, opts.threads)
+                          : new std::ofstream(opts.json_file, std::ios_base::binary));
     std::ostream &json_out = *json_outp;
 
     if (!json_out) {
         std::cerr << "JSON output file open fails. exit.\n";
         exit(1);
     }
-    bool print_obj_separator = false;
-    // output repeats: we know which subtexts come from splits, we can guarantee they all get merged
-    for (const auto &repeat : repeats) {
-        // after split, some "repeated sequences" may actually have a single occurrence
-        if (repeat.second.size() > 1) {
-            if (print_obj_separator) json_out << "\n";
-                emit_verbose_repeat(json_out, repeat.first, repeat.second, charmap, linemap);
-            print_obj_separator = true;
+
+    ShardedGroups groups(group_shards);
+    std::optional<ReferenceAccessor> accessor;
+    std::optional<MappedFile> mapped_input;   // subtexts are views into it, it is kept until the groups are written
+
+    // outputs of the workers, in order: repeat records separated by newlines, or protobuf messages
+    bool written = false;
+    auto write = [&](const std::string &records) {
+        if (records.empty()) return;
+        if (written && !opts.protobuf) json_out << "\n";
+        json_out.write(records.data(), records.size());
+        written = true;
+    };
+    // the end of a compressed output is only written on close, where a full disk shows
+    auto finish = [&]() {
+        if (!pgzstr::close_output(json_out)) {
+            std::cerr << "JSON output file write fails. exit.\n";
+            exit(1);
         }
+        return 0;
+    };
+
+    // the files with copies are repeated whole: they are written first, as a repeat at the start of the file kept that
+    // the emitter expands to its copies, without having gone through findrepset
+    if (!aliases.empty()) {
+        std::string records;
+        RepeatEmitter emitter(records, charmap, linemap, aliases, opts.protobuf);
+        for (size_t file : aliases.files()) {
+            unsigned long start = charmap.offset(file);
+            unsigned long end = file + 1 < charmap.size() ? charmap.offset(file + 1) : concat->view().size();
+            std::string_view text = concat->view().substr(start, end - start);
+            if (!should_skip(text, opts)) emitter.emit(text, std::array<unsigned long, 1>{start});
+        }
+        write(records);
+    }
+
+    // first pass: collecting repeats in parallel blocks, splitting them if necessary (and emitting those that need
+    // not be while streaming)
+    auto collect = [&](std::string_view block, std::string &records) {
+        RepeatEmitter emitter(records, charmap, linemap, aliases, opts.protobuf);
+        RepeatCollector collector(charmap, opts, emitter, groups);
+        RepeatReader reader(block);
+        std::vector<unsigned long> positions;
+
+        try {
+            if (accessor) {
+                // text and positions are expanded through the accessor, the mapped concat outlives the groups
+                RepeatReference ref{};
+                while (reader.next(ref)) {
+                    positions.assign(accessor->positions_begin(ref), accessor->positions_end(ref));
+                    collector.add(accessor->text(ref), false, positions);
+                }
+            } else {
+                std::string_view subtext;
+                while (reader.next(subtext, positions)) {
+                    collector.add(subtext, !mapped_input, positions);
+                }
+            }
+        } catch (...) {
+            collector.flush();   // keep what was read before the error
+            throw;
+        }
+        collector.flush();
+    };
+
+    // uncompressed input is mapped and parsed in place, compressed input is decompressed into blocks on a read-ahead
+    // thread
+    std::unique_ptr<std::istream> bwtp;
+    try {
+        if (opts.compress) {
+            bwtp.reset(new pgzstr::ifstream(opts.bwt_file));
+        } else {
+            mapped_input.emplace(opts.bwt_file, MADV_SEQUENTIAL);
+        }
+    } catch (std::exception &e) {
+        std::cerr << "bwt input file open fails. exit.\n";
+        exit(1);
+    }
+    if (bwtp && !*bwtp) {
+        std::cerr << "bwt input file open fails. exit.\n";
+        exit(1);
+    }
+
+    auto cut = opts.reference ? complete_lines : complete_repeats;
+    try {
+        if (opts.reference) {
+            accessor.emplace((*opts.reference)[0], (*opts.reference)[1]);
+        }
+        if (mapped_input) {
+            process_view_blocks(mapped_input->view(), opts.threads, cut, collect, write);
+        } else {
+            process_blocks(*bwtp, opts.threads, cut, collect, write);
+        }
+    } catch (std::runtime_error &e) {
+        std::cerr << "Failed to read repeat entries in " << opts.bwt_file << ": " << e.what();
     }
-    return 0;
+
+    if (opts.classes || opts.drop_nested) {
+        // the grouped repeats of every shard are gathered, filtered and consolidated, then written in chunks
+        RepeatTable repeats;
+        size_t next_shard = 0;
+        run_ordered<size_t, RepeatTable>(opts.threads, [&](size_t &shard) {
+            shard = next_shard;
+            return next_shard++ < groups.size();
+        }, [&](size_t &shard, RepeatTable &table) {
+            groups.for_each(shard, [&](std::string_view text, const PositionRange &positions) {
+                if (positions.size() > 1) table.add(text, positions);
+            });
+        }, [&](const RepeatTable &table) {
+            repeats.append(table);
+        });
+
+        if (opts.drop_nested) repeats = drop_nested_repeats(repeats);
+        std::vector<CloneClass> classes;
+        if (opts.classes) classes = consolidate_classes(repeats, charmap, linemap);
+
+        const size_t chunk = 4096;
+        size_t count = opts.classes ? classes.size() : repeats.size();
+        size_t next = 0;
+        run_ordered<size_t>(opts.threads, [&](size_t &first) {
+            first = next;
+            next += chunk;
+            return first < count;
+        }, [&](size_t &first, std::string &records) {
+            RepeatEmitter emitter(records, charmap, linemap, aliases, opts.protobuf);
+            for (size_t i = first; i < std::min(first + chunk, count); i++) {
+                if (opts.classes) emitter.emit(classes[i]);
+                else emitter.emit(repeats.text(i), repeats.positions_of(i));
+            }
+        }, write);
+        return finish();
+    }
+
+    // second pass: output the grouped repeats, one shard per task
+    size_t next_shard = 0;
+    run_ordered<size_t>(opts.threads, [&](size_t &shard) {
+        shard = next_shard;
+        return next_shard++ < groups.size();
+    }, [&](size_t &shard, std::string &records) {
+        RepeatEmitter emitter(records, charmap, linemap, aliases, opts.protobuf);
+        groups.for_each(shard, [&](std::string_view text, const PositionRange &positions) {
+            // after split, some "repeated sequences" may actually have a single occurrence
+            if (positions.size() > 1) {
+                emitter.emit(text, positions);
+            }
+        });
+    }, write);
+    return finish();
 }
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "repeatgroups.h"
+
+// Drops the repeats dominated by longer ones: those whose every occurrence lies inside an occurrence of another
+// repeat. Occurrences no longer cross file ends, so a single sweep over the concat positions, sorted by start and then
+// by decreasing end, covers every file: an occurrence is nested when an interval seen before it reaches its end.
+inline RepeatTable drop_nested_repeats(const RepeatTable &repeats) {
+    struct Interval {
+        unsigned long start;
+        unsigned long end;
+        uint32_t repeat;
+    };
+
+    std::vector<Interval> intervals;
+    for (uint32_t r = 0; r < repeats.size(); r++) {
+        size_t length = repeats.text(r).size();
+        for (unsigned long pos : repeats.positions_of(r)) intervals.push_back({pos, pos + length - 1, r});
+    }
+    std::sort(intervals.begin(), intervals.end(), [](const Interval &a, const Interval &b) {
+        return a.start != b.start ? a.start < b.start : a.end > b.end;
+    });
+
+    // occurrences of each repeat that are not nested
+    std::vector<uint32_t> outer(repeats.size(), 0);
+    unsigned long max_end = 0;
+    for (size_t i = 0; i < intervals.size(); i++) {
+        const Interval &interval = intervals[i];
+        if (i == 0 || max_end < interval.end) {
+            outer[interval.repeat]++;
+            max_end = interval.end;
+        }
+    }
+
+    RepeatTable kept;
+    for (uint32_t r = 0; r < repeats.size(); r++) {
+        if (outer[r]) kept.add(repeats.text(r), repeats.positions_of(r));
+    }
+    return kept;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "../util/binarymap.h"
+#include "../util/eliasfano.h"
+#include "../util/mappedfile.h"
+
+// Charmap / linemap index: the start offsets of the entries in the concat are Elias-Fano encoded, the values are kept
+// in a plain array. A lookup resolves to the entry with the last start offset <= pos, as --upper_bound(pos) on a
+// std::map, with a rank instead of a walk down a tree. Binary maps are mapped instead: the index is built from their
+// offset array, and their values are used in place.
+template<typename T>
+class PositionMap {
+protected:
+    EliasFano offsets;
+    std::vector<T> values;
+    std::unique_ptr<MappedFile> file;
+    binarymap::View binary;
+    size_t count = 0;
+
+public:
+    PositionMap() = default;
+
+    // entries in the order they were written: for offsets written more than once, the last value is kept
+    explicit PositionMap(std::vector<std::pair<unsigned long, T>> entries) {
+        binarymap::sort_entries(entries);
+        std::vector<uint64_t> starts;
+        starts.reserve(entries.size());
+        values.reserve(entries.size());
+        for (auto &entry : entries) {
+            starts.push_back(entry.first);
+            values.push_back(std::move(entry.second));
+        }
+        offsets = EliasFano(starts);
+        count = values.size();
+    }
+
+    PositionMap(std::unique_ptr<MappedFile> mapped, binarymap::Kind kind)
+            : file(std::move(mapped)), binary(binarymap::view(file->view(), kind)), count(binary.count) {
+        offsets = EliasFano(binary.offsets, count);
+    }
+
+    size_t size() const { return count; }
+
+    // index of the entry containing pos
+    size_t find(unsigned long pos) const {
+        size_t rank = offsets.rank(pos);
+        return rank ? rank - 1 : 0;
+    }
+
+    unsigned long offset(size_t i) const { return offsets[i]; }
+};
+
+// file path of each position of the concat
+class CharMap : public PositionMap<std::string> {
+public:
+    using PositionMap::PositionMap;
+
+    std::string_view value(size_t i) const { return file ? binary.path(i) : std::string_view(values[i]); }
+
+    std::string_view at(unsigned long pos) const { return value(find(pos)); }
+};
+
+// line number of each position of the concat
+class LineMap : public PositionMap<unsigned int> {
+public:
+    using PositionMap::PositionMap;
+
+    unsigned int value(size_t i) const { return file ? binary.lines[i] : values[i]; }
+
+    unsigned int at(unsigned long pos) const { return value(find(pos)); }
+};
+
+// Reads the "<offset>\t<value>\n" lines of a text map, up to the first one that is not.
+template<typename Add>
+void read_text_map(std::string_view text, const std::string &path, Add add) {
+    const char *p = text.data(), *end = p + text.size();
+    while (true) {
+        while (p != end && std::isspace((unsigned char) *p)) ++p;
+        unsigned long offset;
+        auto res = std::from_chars(p, end, offset);
+        if (res.ec != std::errc()) break;
+        p = res.ptr;
+        if (p == end || *p != '\t') {
+            std::cerr << "Unexpected character at position " << p - text.data() << " in " << path;
+            break;
+        }
+        ++p;
+        auto eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        add(offset, std::string_view(p, (eol ? eol : end) - p));
+        p = eol ? eol + 1 : end;
+    }
+}
+
+// Loads a charmap or linemap written by the preprocessor, binary or text. Throws if it cannot be read.
+template<typename Map, typename T, typename Parse>
+Map load_map(const std::string &path, binarymap::Kind kind, Parse parse) {
+    auto file = std::make_unique<MappedFile>(path, MADV_WILLNEED);
+    if (binarymap::is_binary(file->view())) return Map(std::move(file), kind);
+
+    std::vector<std::pair<unsigned long, T>> entries;
+    read_text_map(file->view(), path, [&](unsigned long offset, std::string_view value) {
+        entries.emplace_back(offset, parse(value));
+    });
+    return Map(std::move(entries));
+}
+
+inline CharMap load_charmap(const std::string &path) {
+    return load_map<CharMap, std::string>(path, binarymap::PATHS, [](std::string_view value) {
+        return std::string(value);
+    });
+}
+
+inline LineMap load_linemap(const std::string &path) {
+    return load_map<LineMap, unsigned int>(path, binarymap::LINES, [](std::string_view value) {
+        unsigned int line = 0;
+        std::from_chars(value.data(), value.data() + value.size(), line);
+        return line;
+    });
+}
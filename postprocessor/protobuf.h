@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Minimal encoder for the clonedetection messages of repeats.proto, written as a stream of
+// length-delimited Repeat messages (the framing of protobuf's writeDelimitedTo / parseDelimitedFrom).
+// Field numbers below must be kept in sync with repeats.proto.
+namespace protobuf {
+
+enum wire_type {
+    varint = 0, length_delimited = 2
+};
+
+inline void put_varint(std::string &buf, unsigned long long value) {
+    while (value >= 0x80) {
+        buf.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    buf.push_back(static_cast<char>(value));
+}
+
+inline void put_tag(std::string &buf, unsigned field, wire_type type) {
+    put_varint(buf, (field << 3) | type);
+}
+
+inline void put_uint64(std::string &buf, unsigned field, unsigned long long value) {
+    put_tag(buf, field, varint);
+    put_varint(buf, value);
+}
+
+inline void put_bytes(std::string &buf, unsigned field, std::string_view bytes) {
+    put_tag(buf, field, length_delimited);
+    put_varint(buf, bytes.size());
+    buf.append(bytes.data(), bytes.size());
+}
+
+// builds one clonedetection.Repeat message at a time and appends it to out with its length prefix
+class RepeatWriter {
+private:
+    std::string &out;
+    std::string message;
+    std::string position;
+
+public:
+    explicit RepeatWriter(std::string &out) : out(out) {}
+
+    void begin(std::string_view text) {
+        message.clear();
+        put_bytes(message, 3, text);    // Repeat.text
+    }
+
+    void add_position(unsigned long concat_pos, unsigned long transformed_pos, std::string_view source_file,
+                      unsigned long start_line, unsigned long end_line) {
+        position.clear();
+        put_uint64(position, 1, concat_pos);    // Position.concat_pos
+        put_uint64(position, 2, transformed_pos);   // Position.transformed_pos
+        put_bytes(position, 3, source_file);    // Position.source_file
+        put_uint64(position, 4, start_line);    // Position.start_line
+        put_uint64(position, 5, end_line);      // Position.end_line
+        put_bytes(message, 2, position);        // Repeat.pos
+    }
+
+    void end() {
+        put_varint(out, message.size());
+        out.append(message);
+    }
+};
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string_view>
+#include "../util/mappedfile.h"
+
+// one line of the reference-only findrepset output (-ref):
+// "<length> <concat offset> <first SA index> <last SA index>"
+struct RepeatReference {
+    unsigned long length;
+    unsigned long offset;
+    unsigned long sa_start;
+    unsigned long sa_end;   // inclusive
+};
+
+// expands reference-only records lazily from the concatenated text and the suffix array saved by findrepset (-sa)
+class ReferenceAccessor {
+private:
+    MappedFile concat;
+    MappedFile suffix_array;
+
+public:
+    // findrepset stores the suffix array as native 32-bit unsigned integers
+    using sa_entry = unsigned int;
+
+    ReferenceAccessor(const std::string &concat_file, const std::string &sa_file)
+            : concat(concat_file, MADV_RANDOM), suffix_array(sa_file, MADV_RANDOM) {
+        if (suffix_array.size() % sizeof(sa_entry) != 0) {
+            throw std::runtime_error("Suffix array " + sa_file + " is not a sequence of 32-bit entries");
+        }
+    }
+
+    std::string_view text(const RepeatReference &ref) const {
+        if (ref.offset + ref.length > concat.size()) {
+            throw std::runtime_error("Repeat reference lies outside of the concatenated text");
+        }
+        return {concat.data() + ref.offset, ref.length};
+    }
+
+    const sa_entry *positions_begin(const RepeatReference &ref) const {
+        return entries() + ref.sa_start;
+    }
+
+    const sa_entry *positions_end(const RepeatReference &ref) const {
+        if (ref.sa_end >= suffix_array.size() / sizeof(sa_entry) || ref.sa_end < ref.sa_start) {
+            throw std::runtime_error("Suffix array interval out of bounds");
+        }
+        return entries() + ref.sa_end + 1;
+    }
+
+private:
+    const sa_entry *entries() const {
+        return reinterpret_cast<const sa_entry *>(suffix_array.data());
+    }
+};
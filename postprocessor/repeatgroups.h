@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "../util/fingerprint.h"
+
+// positions of a group of repeats, sorted and without duplicates
+struct PositionRange {
+    const unsigned long *first;
+    const unsigned long *last;
+
+    const unsigned long *begin() const { return first; }
+
+    const unsigned long *end() const { return last; }
+
+    size_t size() const { return last - first; }
+};
+
+// append-only storage for the texts that would not outlive their reader
+class TextArena {
+private:
+    static constexpr size_t chunk_size = (size_t) 1 << 20;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t used = 0;
+    size_t capacity = 0;
+
+public:
+    std::string_view store(std::string_view text) {
+        if (text.size() > capacity - used) {
+            capacity = std::max(chunk_size, text.size());
+            chunks.emplace_back(new char[capacity]);
+            used = 0;
+        }
+        char *dest = chunks.back().get() + used;
+        std::memcpy(dest, text.data(), text.size());
+        used += text.size();
+        return {dest, text.size()};
+    }
+};
+
+// Occurrences of repeated texts grouped by the fingerprint of the text. Each distinct text is stored once (or just
+// referenced when it lives in a mapped file), and positions are appended to flat arrays that are only sorted into
+// per-group ranges when the groups are read.
+class RepeatGroups {
+private:
+    std::unordered_map<Fingerprint, uint32_t, FingerprintHash> index;
+    std::vector<Fingerprint> fingerprints;
+    std::vector<std::string_view> texts;
+    std::vector<uint32_t> entry_groups;
+    std::vector<unsigned long> entry_positions;
+    TextArena arena;
+
+public:
+    // a text that is not copied must remain valid until the groups are read
+    void add(const Fingerprint &fp, std::string_view text, bool copy, unsigned long pos) {
+        auto found = index.try_emplace(fp, texts.size());
+        if (found.second) {
+            fingerprints.push_back(fp);
+            texts.push_back(copy ? arena.store(text) : text);
+        }
+        entry_groups.push_back(found.first->second);
+        entry_positions.push_back(pos);
+    }
+
+    size_t size() const { return texts.size(); }
+
+    // calls f(fingerprint, text, positions) for every group, in fingerprint order so that the order does not depend
+    // on the order of the additions, then releases them
+    template<typename F>
+    void for_each(F f) {
+        // counting sort of the positions by group
+        std::vector<size_t> offsets(texts.size() + 1, 0);
+        for (uint32_t group : entry_groups) offsets[group + 1]++;
+        for (size_t g = 0; g < texts.size(); g++) offsets[g + 1] += offsets[g];
+
+        std::vector<unsigned long> positions(entry_positions.size());
+        std::vector<size_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < entry_positions.size(); i++) {
+            positions[cursor[entry_groups[i]]++] = entry_positions[i];
+        }
+        std::vector<uint32_t>().swap(entry_groups);
+        std::vector<unsigned long>().swap(entry_positions);
+        std::vector<size_t>().swap(cursor);
+
+        std::vector<uint32_t> order(texts.size());
+        for (uint32_t g = 0; g < order.size(); g++) order[g] = g;
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+            const Fingerprint &fa = fingerprints[a], &fb = fingerprints[b];
+            return fa.hi != fb.hi ? fa.hi < fb.hi : fa.lo < fb.lo;
+        });
+
+        for (uint32_t g : order) {
+            unsigned long *first = positions.data() + offsets[g];
+            unsigned long *last = positions.data() + offsets[g + 1];
+            std::sort(first, last);
+            last = std::unique(first, last);
+            f(fingerprints[g], texts[g], PositionRange{first, last});
+        }
+
+        index.clear();
+        fingerprints.clear();
+        texts.clear();
+    }
+};
+
+// RepeatGroups sharded by fingerprint, so that blocks of the input can be grouped concurrently. Each shard also holds
+// the fingerprints of the texts already emitted as whole repeats that may match fragment groups, which are then
+// dropped.
+class ShardedGroups {
+private:
+    struct Shard {
+        std::mutex mutex;
+        RepeatGroups groups;
+        std::unordered_set<Fingerprint, FingerprintHash> emitted;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    friend class GroupBatch;
+
+public:
+    explicit ShardedGroups(size_t count) {
+        for (size_t i = 0; i < count; i++) shards.emplace_back(new Shard());
+    }
+
+    size_t size() const { return shards.size(); }
+
+    size_t shard_of(const Fingerprint &fp) const { return fp.hi % shards.size(); }
+
+    // calls f(text, positions) for the groups of shard i that were not emitted whole, then releases them
+    template<typename F>
+    void for_each(size_t i, F f) {
+        Shard &shard = *shards[i];
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        shard.groups.for_each([&](const Fingerprint &fp, std::string_view text, const PositionRange &positions) {
+            if (shard.emitted.empty() || !shard.emitted.count(fp)) f(text, positions);
+        });
+        std::unordered_set<Fingerprint, FingerprintHash>().swap(shard.emitted);
+    }
+};
+
+// Additions to a ShardedGroups made by one worker, moved to the shards in one locked pass per shard by flush().
+// Texts must remain valid until then, hold() keeps a copy of those that would not.
+class GroupBatch {
+private:
+    struct Entry {
+        Fingerprint fp;
+        std::string_view text;
+        bool copy;
+        unsigned long pos;
+    };
+
+    ShardedGroups &target;
+    std::vector<std::vector<Entry>> entries;
+    std::vector<std::vector<Fingerprint>> emitted;
+    TextArena pending;
+
+public:
+    explicit GroupBatch(ShardedGroups &target)
+            : target(target), entries(target.size()), emitted(target.size()) {}
+
+    void add(const Fingerprint &fp, std::string_view text, bool copy, unsigned long pos) {
+        entries[target.shard_of(fp)].push_back(Entry{fp, text, copy, pos});
+    }
+
+    std::string_view hold(std::string_view text) { return pending.store(text); }
+
+    void add_emitted(const Fingerprint &fp) {
+        emitted[target.shard_of(fp)].push_back(fp);
+    }
+
+    void flush() {
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].empty() && emitted[i].empty()) continue;
+            ShardedGroups::Shard &shard = *target.shards[i];
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            for (const Entry &e : entries[i]) shard.groups.add(e.fp, e.text, e.copy, e.pos);
+            shard.emitted.insert(emitted[i].begin(), emitted[i].end());
+            entries[i].clear();
+            emitted[i].clear();
+        }
+        pending = TextArena();
+    }
+};
+
+// The repeats left once grouped, with their positions copied out of the groups, for the stages that look across
+// repeats before anything is written. Texts are views into the storage of the groups (or the mapped input).
+class RepeatTable {
+private:
+    std::vector<std::string_view> texts;
+    std::vector<size_t> offsets{0};    // positions of repeat i are positions[offsets[i], offsets[i + 1])
+    std::vector<unsigned long> positions;
+
+public:
+    void add(std::string_view text, const PositionRange &range) {
+        texts.push_back(text);
+        positions.insert(positions.end(), range.begin(), range.end());
+        offsets.push_back(positions.size());
+    }
+
+    void append(const RepeatTable &other) {
+        for (size_t i = 0; i < other.size(); i++) add(other.text(i), other.positions_of(i));
+    }
+
+    size_t size() const { return texts.size(); }
+
+    std::string_view text(size_t i) const { return texts[i]; }
+
+    PositionRange positions_of(size_t i) const {
+        return {positions.data() + offsets[i], positions.data() + offsets[i + 1]};
+    }
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+#include "reference.h"
+
+// Reader of findrepset output held in memory (a mapped file or a block of it). Entries are walked with pointer
+// arithmetic and numbers parsed with from_chars; subtexts are returned as views into the input.
+class RepeatReader {
+private:
+    const char *p;
+    const char *end;
+
+    void skip_space() {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\v' || *p == '\f')) ++p;
+    }
+
+    void skip_line() {
+        auto eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        p = eol ? eol + 1 : end;
+    }
+
+    // the text up to the next ':' must be label
+    void expect_label(std::string_view label, const char *error) {
+        auto colon = static_cast<const char *>(std::memchr(p, ':', end - p));
+        if (!colon || std::string_view(p, colon - p) != label) throw std::runtime_error(error);
+        p = colon + 1;
+    }
+
+    unsigned long number() {
+        skip_space();
+        unsigned long value = 0;
+        auto res = std::from_chars(p, end, value);
+        if (res.ec != std::errc()) throw std::runtime_error("Expected a number");
+        p = res.ptr;
+        return value;
+    }
+
+public:
+    explicit RepeatReader(std::string_view data) : p(data.data()), end(data.data() + data.size()) {}
+
+    // reads the next entry of the default output format, returns false at the end of the input
+    bool next(std::string_view &subtext, std::vector<unsigned long> &positions) {
+        skip_space();
+        if (p == end) return false;
+
+        expect_label("Repeat size", "Expected repeat size in first Repeat line");
+        unsigned long repeat_size = number();
+        skip_line();
+
+        expect_label("Number of occurrences", "Expected number of occurrences in second Repeat line");
+        unsigned long repeat_occurrences = number();
+        skip_line();
+
+        expect_label("Repeat subtext", "Expected repeat subtext in third Repeat line");
+        if (p != end) ++p;   // the space immediately after
+        if ((unsigned long) (end - p) < repeat_size) throw std::runtime_error("Truncated repeat subtext");
+        subtext = std::string_view(p, repeat_size);
+        p += repeat_size;
+        skip_line();
+
+        expect_label("Suffix array interval of this repeat", "Expected suffix array interval in fourth Repeat line");
+        skip_line();
+
+        expect_label("Text positions of this repeat", "Expected text positions in fifth Repeat line");
+        positions.clear();
+        for (unsigned long i = 0; i < repeat_occurrences; i++) {
+            positions.push_back(number());
+        }
+        return true;
+    }
+
+    // reads the next line of the reference-only output format, returns false at the end of the input
+    bool next(RepeatReference &ref) {
+        skip_space();
+        if (p == end) return false;
+
+        try {
+            ref.length = number();
+            ref.offset = number();
+            ref.sa_start = number();
+            ref.sa_end = number();
+        } catch (std::runtime_error &) {
+            throw std::runtime_error("Expected a repeat reference line");
+        }
+        return true;
+    }
+};
+
+// length of the prefix of block made of complete entries of the default output format, npos if there is none. The
+// subtext of an entry may hold newlines, so entries are walked through their sizes.
+inline size_t complete_repeats(std::string_view block) {
+    size_t complete = std::string_view::npos;
+    size_t p = 0;
+
+    while (true) {
+        while (p < block.size() && std::isspace((unsigned char) block[p])) p++;
+        if (p == block.size()) return p;
+
+        size_t size_line_end = block.find('\n', p);
+        if (size_line_end == std::string_view::npos) return complete;
+        size_t occurrences_line_end = block.find('\n', size_line_end + 1);
+        if (occurrences_line_end == std::string_view::npos) return complete;
+        size_t subtext_label = block.find(':', occurrences_line_end + 1);
+        if (subtext_label == std::string_view::npos) return complete;
+
+        size_t size_value = block.find_first_not_of(' ', block.find(':', p) + 1);
+        unsigned long repeat_size = 0;
+        std::from_chars(block.data() + std::min(size_value, size_line_end), block.data() + size_line_end, repeat_size);
+        // end of the subtext, then of the suffix array interval and text positions lines
+        size_t end = subtext_label + 2 + repeat_size;
+        for (int line = 0; line < 3 && end <= block.size(); line++) {
+            end = block.find('\n', end);
+            if (end == std::string_view::npos) return complete;
+            end++;
+        }
+        if (end > block.size()) return complete;
+        complete = p = end;
+    }
+}
+
+// length of the prefix of block made of complete lines, npos if there is none
+inline size_t complete_lines(std::string_view block) {
+    size_t cut = block.rfind('\n');
+    return cut == std::string_view::npos ? cut : cut + 1;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "../util/fingerprint.h"
+#include "../util/parallel.h"
+#include "transform.h"
+
+const size_t DISTINCT = SIZE_MAX;
+
+// whether two transformed files are the same past their --debug headers, text and line offsets alike: comment
+// removal may map the same text to different lines
+inline bool same_content(const TransformedFile &a, size_t a_header, const TransformedFile &b, size_t b_header) {
+    std::string_view a_text = std::string_view(a.data).substr(a_header);
+    std::string_view b_text = std::string_view(b.data).substr(b_header);
+    if (a_text != b_text || a.lines.size() != b.lines.size()) return false;
+    for (size_t i = 0; i < a.lines.size(); i++) {
+        if (a.lines[i] - a_header != b.lines[i] - b_header) return false;
+    }
+    return true;
+}
+
+// For each transformed file, the index of the first file with the same content, or DISTINCT for the first of its
+// content. Files are fingerprinted in parallel, and files with the same fingerprint compared whole. Empty files are
+// all kept: they share their offset with the next file, and could not be told apart from it.
+inline std::vector<size_t> find_duplicates(const std::vector<TransformedFile> &files,
+                                           const std::vector<size_t> &headers, unsigned threads) {
+    std::vector<Fingerprint> fingerprints(files.size());
+    parallel_for(files.size(), threads, [&](size_t i) {
+        fingerprints[i] = fingerprint(std::string_view(files[i].data).substr(headers[i]));
+    });
+
+    std::vector<size_t> representatives(files.size(), DISTINCT);
+    std::unordered_map<Fingerprint, std::vector<size_t>, FingerprintHash> seen;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (files[i].data.size() == headers[i]) continue;
+        std::vector<size_t> &candidates = seen[fingerprints[i]];
+        for (size_t candidate : candidates) {
+            if (same_content(files[candidate], headers[candidate], files[i], headers[i])) {
+                representatives[i] = candidate;
+                break;
+            }
+        }
+        if (representatives[i] == DISTINCT) candidates.push_back(i);
+    }
+    return representatives;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../util/fingerprint.h"
+#include "transform.h"
+
+// Transformed file data held in a cache entry, written to the output by copy_cached.
+struct CachedData {
+    std::string path;   // of the entry, empty if the data is in memory
+    uint64_t offset = 0;
+    uint64_t size = 0;
+};
+
+// Content-addressed cache of transformed files (--cache <dir>): an entry is named after the fingerprint of the content
+// read, seeded with the options transforming it and the version of the transformations, and holds the transformed
+// content and its line offsets. A file read again with the same options is not transformed, its lines are read from
+// the entry and its content copied from it into the output. Entries are written to temporary files renamed into
+// place, so that concurrent runs sharing a cache never see a partial entry; nothing is ever evicted.
+//
+// An entry starts with a header, followed by the line offsets as an array of 64-bit integers, then the content.
+class FileCache {
+private:
+    static constexpr char MAGIC[8] = {'C', 'R', 'C', 'A', 'C', 'H', 'E', '1'};
+    // part of every key, so that entries written by an older transformation are not reused: to be bumped whenever
+    // the output of the transformations or the format of the entries changes
+    static constexpr uint64_t VERSION = 1;
+
+    struct Header {
+        char magic[8];
+        uint64_t size;
+        uint64_t line_count;
+    };
+
+    std::string dir;
+    uint64_t seed;
+
+    static void write_all(int fd, const char *data, size_t size) {
+        for (size_t written = 0; written < size;) {
+            ssize_t n = write(fd, data + written, size - written);
+            if (n < 0) throw std::runtime_error(std::string("cache entry write fails: ") + std::strerror(errno));
+            written += n;
+        }
+    }
+
+    static bool read_all(int fd, void *data, size_t size, uint64_t offset) {
+        for (size_t filled = 0; filled < size;) {
+            ssize_t n = pread(fd, static_cast<char *>(data) + filled, size - filled, offset + filled);
+            if (n <= 0) return false;
+            filled += n;
+        }
+        return true;
+    }
+
+public:
+    // throws if the directory cannot be created
+    FileCache(std::string dir, const TransformOptions &opts) : dir(std::move(dir)) {
+        // every option changing the output, including those not instantiated per combination
+        seed = VERSION << 32 | transform_flags(opts) | (opts.eof ? TRANSFORM_COMBINATIONS : 0u);
+        std::error_code error;
+        std::filesystem::create_directories(this->dir, error);
+        if (error) throw std::runtime_error("cache directory " + this->dir + " creation fails: " + error.message());
+    }
+
+    // The path of the entry of a file content, transformed after its --debug header, if any. The header is part of
+    // the entry: removing comments and spaces may erase its end.
+    std::string entry(std::string_view header, std::string_view content) const {
+        static const char digits[] = "0123456789abcdef";
+        Fingerprint fp = fingerprint(content, header.empty() ? seed : fingerprint(header, seed).lo);
+        std::string name(32, '0');
+        for (int i = 0; i < 16; i++) {
+            name[i] = digits[fp.hi >> (60 - 4 * i) & 15];
+            name[16 + i] = digits[fp.lo >> (60 - 4 * i) & 15];
+        }
+        return dir + "/" + name;
+    }
+
+    // Reads the entry at path into an empty out: its line offsets, and its content if load is set, the place of its
+    // content in the entry otherwise. Returns false if there is no such entry, or a truncated one.
+    static bool lookup(const std::string &path, TransformedFile &out, CachedData &cached, bool load) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        Header header{};
+        struct stat st{};
+        bool found = fstat(fd, &st) == 0 && read_all(fd, &header, sizeof(header), 0)
+                     && std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0
+                     && header.line_count <= (uint64_t) st.st_size / sizeof(uint64_t)
+                     && (uint64_t) st.st_size == sizeof(header) + header.line_count * sizeof(uint64_t) + header.size;
+        std::vector<uint64_t> lines(found ? header.line_count : 0);
+        found = found && read_all(fd, lines.data(), lines.size() * sizeof(uint64_t), sizeof(header));
+
+        uint64_t offset = sizeof(header) + lines.size() * sizeof(uint64_t);
+        if (found && load) {
+            out.data.resize(header.size);
+            found = read_all(fd, &out.data[0], header.size, offset);
+        }
+        close(fd);
+        if (!found) return false;
+
+        out.lines.assign(lines.begin(), lines.end());
+        cached = load ? CachedData{} : CachedData{path, offset, header.size};
+        return true;
+    }
+
+    // writes the entry at path of a transformed file
+    static void store(const std::string &path, const TransformedFile &file) {
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.size = file.data.size();
+        header.line_count = file.lines.size();
+        std::vector<uint64_t> lines(file.lines.begin(), file.lines.end());
+
+        static std::atomic<unsigned long> next_temporary{0};
+        std::string temporary = path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(next_temporary++);
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("cache entry " + temporary + " open fails: " + std::strerror(errno));
+        try {
+            write_all(fd, reinterpret_cast<const char *>(&header), sizeof(header));
+            write_all(fd, reinterpret_cast<const char *>(lines.data()), lines.size() * sizeof(uint64_t));
+            write_all(fd, file.data.data(), header.size);
+        } catch (...) {
+            close(fd);
+            unlink(temporary.c_str());
+            throw;
+        }
+        close(fd);
+        if (rename(temporary.c_str(), path.c_str()) != 0) {
+            unlink(temporary.c_str());
+            throw std::runtime_error("cache entry " + path + " rename fails: " + std::strerror(errno));
+        }
+    }
+};
+
+// Copies cached data to the output at offset, within the kernel with copy_file_range, or through a buffer where the
+// file systems do not allow it.
+inline void copy_cached(const CachedData &cached, int out, uint64_t offset) {
+    if (cached.size == 0) return;
+    int in = open(cached.path.c_str(), O_RDONLY);
+    if (in < 0) throw std::runtime_error("cache entry " + cached.path + " open fails: " + std::strerror(errno));
+
+    off_t in_offset = cached.offset, out_offset = offset;
+    uint64_t left = cached.size;
+    while (left > 0) {
+        ssize_t n = copy_file_range(in, &in_offset, out, &out_offset, left, 0);
+        if (n <= 0) break;
+        left -= n;
+    }
+
+    std::vector<char> buffer(left ? 1 << 20 : 0);
+    while (left > 0) {
+        ssize_t n = pread(in, buffer.data(), std::min<uint64_t>(buffer.size(), left), in_offset);
+        if (n <= 0) {
+            close(in);
+            throw std::runtime_error("cache entry " + cached.path + " read fails");
+        }
+        for (ssize_t written = 0; written < n;) {
+            ssize_t w = pwrite(out, buffer.data() + written, n - written, out_offset + written);
+            if (w < 0) {
+                close(in);
+                throw std::runtime_error(std::string("output file write fails: ") + std::strerror(errno));
+            }
+            written += w;
+        }
+        in_offset += n;
+        out_offset += n;
+        left -= n;
+    }
+    close(in);
+}
@@ -0,0 +1,413 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "../util/parallel.h"
+#include "transform.h"
+
+// A minimal io_uring, driven with the raw system calls: the submission queue, its entries and the completion queue
+// are mapped from the kernel, and entries are submitted in batches.
+class IoUring {
+private:
+    int fd = -1;
+    io_uring_params params{};
+    void *sq_ring = MAP_FAILED;
+    void *cq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    io_uring_sqe *sqes = nullptr;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe *cqes;
+    unsigned tail = 0;      // of the submission queue, published on submit
+    unsigned submitted = 0;
+
+    template<typename T>
+    static T *at(void *ring, unsigned offset) {
+        return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+    }
+
+    void release() {
+        if (sqes) munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        if (fd >= 0) close(fd);
+    }
+
+public:
+    // throws if the kernel does not provide io_uring
+    explicit IoUring(unsigned entries) {
+        fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0) throw std::runtime_error(std::strerror(errno));
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                       IORING_OFF_SQ_RING);
+        cq_ring = single_mmap ? sq_ring : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        void *mapped_sqes = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || mapped_sqes == MAP_FAILED) {
+            std::string error = std::strerror(errno);
+            release();
+            throw std::runtime_error(error);
+        }
+        sqes = static_cast<io_uring_sqe *>(mapped_sqes);
+
+        sq_head = at<unsigned>(sq_ring, params.sq_off.head);
+        sq_tail = at<unsigned>(sq_ring, params.sq_off.tail);
+        sq_mask = at<unsigned>(sq_ring, params.sq_off.ring_mask);
+        sq_array = at<unsigned>(sq_ring, params.sq_off.array);
+        cq_head = at<unsigned>(cq_ring, params.cq_off.head);
+        cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+        cq_mask = at<unsigned>(cq_ring, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+        tail = submitted = *sq_tail;
+    }
+
+    IoUring(const IoUring &) = delete;
+
+    IoUring &operator=(const IoUring &) = delete;
+
+    ~IoUring() {
+        release();
+    }
+
+    // whether the kernel supports all the operations
+    bool supports(std::initializer_list<unsigned> ops) {
+        const unsigned count = 256;
+        std::vector<char> buffer(sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op), 0);
+        auto probe = reinterpret_cast<io_uring_probe *>(buffer.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, count) < 0) return false;
+        return std::all_of(ops.begin(), ops.end(), [probe](unsigned op) {
+            return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        });
+    }
+
+    // the next free submission entry, cleared, or nullptr if the queue is full
+    io_uring_sqe *next_entry() {
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= params.sq_entries) return nullptr;
+        unsigned index = tail & *sq_mask;
+        sq_array[index] = index;
+        tail++;
+        std::memset(&sqes[index], 0, sizeof(io_uring_sqe));
+        return &sqes[index];
+    }
+
+    // submits the new entries and waits for at least wait completions
+    void submit(unsigned wait) {
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        while (true) {
+            long res = syscall(__NR_io_uring_enter, fd, tail - submitted, wait, wait ? IORING_ENTER_GETEVENTS : 0,
+                               nullptr, 0);
+            if (res >= 0) {
+                submitted += res;
+                if (submitted == tail) return;
+                wait = 0;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                throw std::runtime_error(std::string("io_uring submission fails: ") + std::strerror(errno));
+            }
+        }
+    }
+
+    // calls f(cqe) for the completions available
+    template<typename F>
+    void for_each_completion(F f) {
+        unsigned head = *cq_head;
+        for (unsigned end = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE); head != end; head++) {
+            f(cqes[head & *cq_mask]);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+};
+
+// a file read whole, or the error that prevented it
+struct ReadFile {
+    size_t index;
+    std::string content;
+    int error;
+};
+
+// Reads files with io_uring, keeping up to slots files in flight: each is opened and its size queried at once, then
+// read in as few reads as its size allows and closed. Files are handed to take(file) in the order they are read.
+class UringFileReader {
+private:
+    enum Operation : uint64_t {
+        OPEN, STAT, READ, CLOSE
+    };
+
+    struct Slot {
+        size_t index = 0;
+        int fd = -1;
+        int error = 0;
+        int waiting = 0;        // completions expected before the next step
+        struct statx stat{};
+        bool sized = false;     // the size is known, unless the file could not be queried
+        std::string content;
+        size_t filled = 0;
+        size_t requested = 0;
+        bool busy = false;
+    };
+
+    IoUring ring;
+    std::vector<Slot> slots;
+
+    io_uring_sqe *entry(size_t slot, Operation op) {
+        io_uring_sqe *sqe = ring.next_entry();
+        if (!sqe) {     // the ring has room for twice the entries the slots have pending at once
+            ring.submit(0);
+            sqe = ring.next_entry();
+        }
+        sqe->user_data = (uint64_t) slot << 2 | op;
+        return sqe;
+    }
+
+    void read(size_t s) {
+        Slot &slot = slots[s];
+        // one more than the size, to see the end of the file in the same read
+        size_t expected = slot.sized ? (size_t) slot.stat.stx_size + 1 : 0;
+        size_t length = std::min<size_t>(expected > slot.filled ? expected - slot.filled : 1 << 16, 1 << 30);
+        slot.content.resize(slot.filled + length);
+        slot.requested = length;
+        io_uring_sqe *sqe = entry(s, READ);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = slot.fd;
+        sqe->addr = (uint64_t) (slot.content.data() + slot.filled);
+        sqe->len = (uint32_t) length;
+        sqe->off = slot.filled;
+    }
+
+    template<typename Take>
+    void finish(size_t s, Take &take) {
+        Slot &slot = slots[s];
+        slot.content.resize(slot.filled);
+        take(ReadFile{slot.index, std::move(slot.content), slot.error});
+        slot.content = std::string();
+        if (slot.fd >= 0) {
+            io_uring_sqe *sqe = entry(s, CLOSE);
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = slot.fd;
+            slot.waiting = 1;
+        } else {
+            slot.busy = false;
+        }
+    }
+
+    template<typename Take>
+    void complete(const io_uring_cqe &cqe, Take &take) {
+        size_t s = cqe.user_data >> 2;
+        Slot &slot = slots[s];
+        switch (cqe.user_data & 3) {
+            case OPEN:
+                if (cqe.res < 0) slot.error = -cqe.res;
+                else slot.fd = cqe.res;
+                break;
+            case STAT:
+                slot.sized = cqe.res >= 0;     // otherwise, the file is read until a read returns nothing
+                break;
+            case READ:
+                if (cqe.res < 0) {
+                    slot.error = -cqe.res;
+                    finish(s, take);
+                } else {
+                    slot.filled += cqe.res;
+                    bool at_end = cqe.res == 0 ||
+                                  (slot.sized && (size_t) cqe.res < slot.requested && slot.filled >= slot.stat.stx_size);
+                    if (at_end) finish(s, take);
+                    else read(s);
+                }
+                return;
+            case CLOSE:
+                slot.busy = false;
+                return;
+        }
+        if (--slot.waiting == 0) {
+            if (slot.error) finish(s, take);
+            else read(s);
+        }
+    }
+
+public:
+    // throws if io_uring or the operations needed are not available
+    explicit UringFileReader(unsigned slots) : ring(4 * slots), slots(slots) {
+        if (!ring.supports({IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE})) {
+            throw std::runtime_error("io_uring file operations are not supported");
+        }
+    }
+
+    // Reads the files at paths, each once more() accepts it; a false from more() stops the reading once the files in
+    // flight are closed.
+    template<typename More, typename Take>
+    void read_all(const std::vector<std::string> &paths, More more, Take take) {
+        size_t next = 0;
+        bool stopping = false;
+        while (true) {
+            for (size_t s = 0; s < slots.size() && next < paths.size() && !stopping; s++) {
+                if (slots[s].busy) continue;
+                if (!more()) {
+                    stopping = true;
+                    break;
+                }
+                Slot &slot = slots[s];
+                slot = Slot();
+                slot.index = next;
+                slot.busy = true;
+                slot.waiting = 2;
+
+                io_uring_sqe *open_sqe = entry(s, OPEN);
+                open_sqe->opcode = IORING_OP_OPENAT;
+                open_sqe->fd = AT_FDCWD;
+                open_sqe->addr = (uint64_t) paths[next].c_str();
+                open_sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+                io_uring_sqe *stat_sqe = entry(s, STAT);
+                stat_sqe->opcode = IORING_OP_STATX;
+                stat_sqe->fd = AT_FDCWD;
+                stat_sqe->addr = (uint64_t) paths[next].c_str();
+                stat_sqe->len = STATX_SIZE;
+                stat_sqe->off = (uint64_t) &slot.stat;
+                next++;
+            }
+            if (std::none_of(slots.begin(), slots.end(), [](const Slot &slot) { return slot.busy; })) return;
+            ring.submit(1);
+            ring.for_each_completion([&](const io_uring_cqe &cqe) { complete(cqe, take); });
+        }
+    }
+};
+
+// A queue of the files read, for the threads transforming them, bounded in number of files.
+class ReadQueue {
+private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<ReadFile> files;
+    size_t capacity;
+    size_t taken = 0;
+    bool stopped = false;
+    bool done = false;
+
+public:
+    explicit ReadQueue(size_t capacity) : capacity(capacity) {}
+
+    // Waits for room for one more file; false once the readers must stop.
+    bool wait_for_room() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return stopped || files.size() + taken < capacity; });
+        if (!stopped) taken++;
+        return !stopped;
+    }
+
+    void push(ReadFile &&file) {
+        std::lock_guard<std::mutex> guard(mutex);
+        files.push_back(std::move(file));
+        if (taken) taken--;
+        changed.notify_all();
+    }
+
+    // the next file read, false once there are no more
+    bool pop(ReadFile &file) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return stopped || done || !files.empty(); });
+        if (stopped || files.empty()) return false;
+        file = std::move(files.front());
+        files.pop_front();
+        changed.notify_all();
+        return true;
+    }
+
+    void finish() {
+        std::lock_guard<std::mutex> guard(mutex);
+        done = true;
+        changed.notify_all();
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopped = true;
+        changed.notify_all();
+    }
+};
+
+// Reads the files at paths and calls consume(file) for each on threads, in no particular order. With io_uring, one
+// thread keeps many opens and reads in flight and hands the files read to the others; otherwise, or with uring
+// false, each thread reads the files it transforms. The first exception thrown by consume stops the reading and is
+// rethrown.
+template<typename Consume>
+void read_files(const std::vector<std::string> &paths, unsigned threads, bool uring, Consume consume) {
+    std::unique_ptr<UringFileReader> reader;
+    if (uring) {
+        try {
+            reader = std::make_unique<UringFileReader>(64);
+        } catch (std::runtime_error &) {
+            // unavailable, as in some containers: the threads read themselves
+        }
+    }
+
+    if (!reader) {
+        parallel_for(paths.size(), threads, [&](size_t i) {
+            ReadFile file{i, std::string(), 0};
+            try {
+                read_file(paths[i], file.content);
+            } catch (std::runtime_error &) {
+                file.error = errno ? errno : EIO;
+            }
+            consume(file);
+        });
+        return;
+    }
+
+    ReadQueue queue(64 + 4 * (size_t) threads);
+    std::exception_ptr read_error;
+    std::thread reading([&]() {
+        try {
+            reader->read_all(paths, [&]() { return queue.wait_for_room(); },
+                             [&](ReadFile &&file) { queue.push(std::move(file)); });
+        } catch (...) {
+            read_error = std::current_exception();
+            queue.stop();
+        }
+        queue.finish();
+    });
+
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        ReadFile file;
+        while (queue.pop(file)) {
+            try {
+                consume(file);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(error_mutex);
+                if (!error) error = std::current_exception();
+                queue.stop();
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < std::max(1u, threads); t++) pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool) t.join();
+    reading.join();
+
+    if (error) std::rethrow_exception(error);
+    if (read_error) std::rethrow_exception(read_error);
+}
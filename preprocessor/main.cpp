@@ -1,19 +1,26 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <algorithm>
+#include <atomic>
 #include <filesystem>
 #include <set>
 #include <optional>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 #include "../util/ArgParser.h"
+#include "../util/binarymap.h"
+#include "../util/parallel.h"
+#include "duplicates.h"
+#include "filecache.h"
+#include "filereader.h"
+#include "normalize.h"
 
 namespace fs = std::filesystem;
 
-static const char SPACE_CHAR = ' ';
-static const char EOF_CHAR = char(26);
-
-enum comment {
-    plain, comment_start, multiline_end, quote, line_comment, multiline_comment
-};
-
 bool endsWith(std::string const &fullString, std::string const &ending) {
     if (fullString.length() >= ending.length()) {
         return (0 == fullString.compare(fullString.length() - ending.length(), ending.length(), ending));
@@ -30,31 +37,45 @@ int main(int argc, char **argv) {
 
     ArgParser args(argv + 4, argv + argc);
 
-    // (\h+)       -> ' '
-    bool normalize_spaces = args.cmdOptionExists("-ns");
-    // (\h+\r?\n)  -> ''
-    bool remove_trailing_spaces = args.cmdOptionExists("-ntr");
-    // (\r?\n)     -> '\n'
-    bool normalize_newlines = args.cmdOptionExists("-nl");
-    // (\r?\n)     -> ' '
-    bool newlines_to_spaces = args.cmdOptionExists("-nl2s");
-    bool eof = args.cmdOptionExists("-eof");
+    TransformOptions opts{
+            args.cmdOptionExists("-ns"),
+            args.cmdOptionExists("-ntr"),
+            args.cmdOptionExists("-nl"),
+            args.cmdOptionExists("-nl2s"),
+            args.cmdOptionExists("--delete-comments"),
+            args.cmdOptionExists("-eof"),
+            args.cmdOptionExists("--linemap"),
+            nullptr
+    };
+    opts.kernel = select_kernel(transform_flags(opts), args.getCmdArg("--kernel").value_or(""));
+    TransformFunction transform_file = select_transform(opts);
     bool debug = args.cmdOptionExists("--debug");
     bool verbose = args.cmdOptionExists("-v");
     bool symlink = args.cmdOptionExists("--symlinks");
-    bool delcmts = args.cmdOptionExists("--delete-comments");
+    bool binary_maps = args.cmdOptionExists("--binary-maps");
+    bool uring = !args.cmdOptionExists("--no-io-uring");
     std::optional<std::vector<std::string>> file_extensions = args.getCmdArgs("--extensions");
     std::optional<std::string> linemap_file = args.getCmdArg("--linemap");
+    std::optional<std::string> aliases_file = args.getCmdArg("--aliases");
+    std::optional<std::string> cache_dir = args.getCmdArg("--cache");
+    unsigned threads = std::stoul(args.getCmdArg("-j").value_or(
+            std::to_string(std::max(1u, std::thread::hardware_concurrency()))));
 
     std::string out_file = argv[2];
     std::string charmap_file = argv[3];
 
-    std::ofstream out(out_file, std::ofstream::binary);
-    std::ofstream charmap(charmap_file);
+    if (!opts.kernel) {
+        std::cerr << "kernel " << *args.getCmdArg("--kernel") << " is not supported. exit.\n";
+        exit(1);
+    }
+
+    int out = open(out_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::ofstream charmap(charmap_file, std::ios_base::binary);
     std::optional<std::ofstream> linemap;
+    std::optional<std::ofstream> aliases;
 
     if (linemap_file) {
-        linemap.emplace(*linemap_file);
+        linemap.emplace(*linemap_file, std::ios_base::binary);
 
         if (!*linemap) {
             std::cerr << "linemap output file open fails. exit.\n";
@@ -62,7 +83,26 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (!out) {
+    if (aliases_file) {
+        aliases.emplace(*aliases_file, std::ios_base::binary);
+
+        if (!*aliases) {
+            std::cerr << "aliases output file open fails. exit.\n";
+            exit(1);
+        }
+    }
+
+    std::optional<FileCache> cache;
+    if (cache_dir) {
+        try {
+            cache.emplace(*cache_dir, opts);
+        } catch (std::runtime_error &e) {
+            std::cerr << e.what() << ". exit.\n";
+            exit(1);
+        }
+    }
+
+    if (out < 0) {
         std::cout << "output file open fails. exit.\n";
         exit(1);
     }
@@ -90,157 +130,165 @@ int main(int argc, char **argv) {
         }
     }
 
+    // first phase: the files are read with io_uring where available and transformed in parallel, each into a buffer
+    // of its own
     std::cout << "Processing files\n";
-    for (const fs::directory_entry &file : files) {
-        std::ifstream in(file.path());
-        if (verbose) {
-            std::cout << "opening input file " << file << "\n";
-        }
-
-        if (!in) {
-            std::cerr << "input file " << file << " open fails. exit.\n";
-            exit(1);
-        }
-
-        charmap << out.tellp() << "\t" << file.path().string() << "\n";
-        if (linemap) {
-            *linemap << out.tellp() << "\t" << 1 << "\n";
-        }
-
-        if (debug) {
-            out << "==================" << file << "==================\n";
-        }
+    std::vector<fs::directory_entry> inputs(files.begin(), files.end());
+    std::vector<TransformedFile> outputs(inputs.size());
+    std::vector<size_t> headers(inputs.size(), 0);   // sizes of the --debug headers
+    std::vector<CachedData> cached(inputs.size());   // content left in the cache, copied from it to the output
+    std::atomic<size_t> cache_hits{0};
+    std::vector<std::string> paths;
+    for (const auto &file : inputs) paths.push_back(file.path().string());
+    std::mutex log_mutex;
+    try {
+        read_files(paths, threads, uring, [&](ReadFile &read) {
+            const fs::directory_entry &file = inputs[read.index];
+            if (verbose) {
+                std::lock_guard<std::mutex> guard(log_mutex);
+                std::cout << "opening input file " << file << "\n";
+            }
 
-        std::filebuf *inbuf = in.rdbuf();
-        std::filebuf *outbuf = out.rdbuf();
-        bool skip_next_space = false;
-        unsigned long space_count = 0;
-        unsigned long line_nb = 2;
-        bool escape = false;
-        enum comment comment = plain;
-        unsigned long comment_length = 0;
-
-        for (int c = inbuf->sbumpc(); c != EOF; c = inbuf->sbumpc()) {
-            // process data in buffer
-            if (normalize_newlines) {
-                if (c == '\r') {
-                    continue;
-                }
+            if (read.error) {
+                std::ostringstream message;
+                message << "input file " << file << " open fails";
+                throw std::runtime_error(message.str());
             }
 
-            if (linemap) {
-                if (c == '\n') {
-                    *linemap << out.tellp() << "\t" << line_nb << "\n";
-                    ++line_nb;
+            TransformedFile &output = outputs[read.index];
+            if (debug) {
+                std::ostringstream header;
+                header << "==================" << file << "==================\n";
+                output.data = header.str();
+                headers[read.index] = output.data.size();
+            }
+            if (cache) {
+                // duplicates are told apart by their content, which --aliases needs in memory
+                std::string entry = cache->entry(output.data, read.content);
+                TransformedFile hit;
+                if (FileCache::lookup(entry, hit, cached[read.index], aliases.has_value())) {
+                    output = std::move(hit);
+                    cache_hits++;
+                } else {
+                    transform_file(read.content, opts, output);
+                    FileCache::store(entry, output);
                 }
+            } else {
+                transform_file(read.content, opts, output);
             }
+            std::string().swap(read.content);
+        });
+    } catch (std::runtime_error &e) {
+        std::cerr << e.what() << ". exit.\n";
+        exit(1);
+    }
 
-            if (delcmts) {
-                if (!escape) {
-                    switch (c) {
-                        case '\\': {
-                            escape = true;
-                            break;
-                        }
-                        case '\n': {
-                            if (comment != multiline_comment) {
-                                outbuf->pubseekoff(-comment_length, std::ios_base::cur);   // erase comment
-                                comment_length = 0;
-                                comment = plain;
-                            }
-                            break;
-                        }
-                        case '/': {
-                            if (comment == plain) {
-                                comment = comment_start;
-                            } else if (comment == comment_start) {
-                                comment = line_comment;
-                            } else if (comment == multiline_end) {
-                                outbuf->pubseekoff(-comment_length, std::ios_base::cur);   // erase comment
-                                comment_length = 0;
-                                comment = plain;
-                                continue;   // not writing the end of the comment
-                            }
-                            break;
-                        }
-                        case '*': {
-                            if (comment == comment_start) {
-                                comment = multiline_comment;
-                            } else if (comment == multiline_comment) {
-                                comment = multiline_end;
-                            }
-                            break;
-                        }
-                        case '"': {
-                            if (comment == plain) {
-                                comment = quote;
-                            } else if (comment == quote) {
-                                comment = plain;
-                            }
-                            break;
-                        }
-                        default: {
-                            if (comment == comment_start) {
-                                comment = plain;
-                            } else if (comment == multiline_end) {
-                                comment = multiline_comment;
-                            }
-                        }
-                    }
-                } else if (c != '\r') { // line continuation support on windows
-                    escape = false;
-                }
+    if (cache) std::cout << "Reused " << cache_hits << " cached files\n";
 
-                if (comment != plain && comment != quote) {
-                    comment_length++;
-                }
-            }
+    // with --aliases, the files with the same content as a file before them are left out, and written to the alias
+    // table as "<offset of the first file>\t<path>" lines instead
+    std::vector<size_t> representatives(inputs.size(), DISTINCT);
+    if (aliases) {
+        representatives = find_duplicates(outputs, headers, threads);
+        std::vector<size_t>().swap(headers);
+        size_t duplicates = 0;
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (representatives[i] == DISTINCT) continue;
+            std::string().swap(outputs[i].data);
+            std::vector<unsigned long>().swap(outputs[i].lines);
+            duplicates++;
+        }
+        std::cout << "Left out " << duplicates << " duplicate files\n";
+    }
+    auto distinct = [&](size_t i) { return representatives[i] == DISTINCT; };
 
-            if (newlines_to_spaces) {
-                if (c == '\n' || c == '\r') {
-                    c = SPACE_CHAR;
-                }
-            }
+    // second phase: the offsets of the files follow from the sizes of those before them, the buffers are written in
+    // place in parallel into the output sized beforehand
+    std::vector<unsigned long> offsets(inputs.size() + 1, 0);
+    for (size_t i = 0; i < inputs.size(); i++) offsets[i + 1] = offsets[i] + outputs[i].data.size() + cached[i].size;
 
-            // space normalization must be after space-producing transformations
-            if (normalize_spaces) {
-                if (std::isblank(c)) {
-                    if (skip_next_space) {
-                        continue;
-                    }
-                    c = SPACE_CHAR;
-                    skip_next_space = true;
-                } else {
-                    skip_next_space = false;
-                }
+    if (ftruncate(out, offsets.back()) != 0) {
+        std::cerr << "output file resize fails: " << std::strerror(errno) << ". exit.\n";
+        exit(1);
+    }
+    posix_fallocate(out, 0, offsets.back());   // only a hint, where the file system supports it
+    std::vector<std::string> linemaps(linemap && !binary_maps ? inputs.size() : 0);
+    try {
+        parallel_for(inputs.size(), threads, [&](size_t i) {
+            if (linemap && !binary_maps && distinct(i)) {
+                append_linemap(linemaps[i], offsets[i], outputs[i].lines);
+                std::vector<unsigned long>().swap(outputs[i].lines);
             }
-
-            if (remove_trailing_spaces) {
-                if (space_count > 0 && (c == '\n' || c == '\r')) {
-                    outbuf->pubseekoff(-space_count, std::ios_base::cur);   // erase spaces
-                }
-                if (std::isblank(c)) {
-                    space_count++;
-                } else {
-                    space_count = 0;
-                }
+            std::string &data = outputs[i].data;
+            for (size_t written = 0; written < data.size();) {
+                ssize_t n = pwrite(out, data.data() + written, data.size() - written, offsets[i] + written);
+                if (n < 0) throw std::runtime_error(std::string("output file write fails: ") + std::strerror(errno));
+                written += n;
             }
+            copy_cached(cached[i], out, offsets[i] + data.size());
+            std::string().swap(data);
+        });
+    } catch (std::runtime_error &e) {
+        std::cerr << e.what() << ". exit.\n";
+        exit(1);
+    }
+    close(out);
 
-            outbuf->sputc (c);
+    if (binary_maps) {
+        // the entries are sorted as the postprocessor sorts the text maps, and written as arrays
+        std::vector<std::pair<unsigned long, std::string>> charmap_entries;
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (distinct(i)) charmap_entries.emplace_back(offsets[i], inputs[i].path().string());
         }
+        charmap_entries.emplace_back(offsets.back(), "");   // blank file name == end
+        binarymap::sort_entries(charmap_entries);
+        binarymap::write_paths(charmap, charmap_entries);
 
-        if (eof) {
-            outbuf->sputc(EOF_CHAR);
+        if (linemap) {
+            std::vector<std::pair<unsigned long, unsigned int>> linemap_entries;
+            for (size_t i = 0; i < inputs.size(); i++) {
+                if (!distinct(i)) continue;
+                unsigned int line_nb = 1;
+                linemap_entries.emplace_back(offsets[i], line_nb);
+                for (unsigned long line : outputs[i].lines) linemap_entries.emplace_back(offsets[i] + line, ++line_nb);
+                std::vector<unsigned long>().swap(outputs[i].lines);
+            }
+            binarymap::sort_entries(linemap_entries);
+            binarymap::write_lines(*linemap, linemap_entries);
         }
-
-        in.close();
+    } else {
+        // the maps are formatted in bulk and written whole
+        std::string charmap_text;
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (!distinct(i)) continue;
+            append_number(charmap_text, offsets[i]);
+            charmap_text.push_back('\t');
+            charmap_text += inputs[i].path().string();
+            charmap_text.push_back('\n');
+            if (linemap) {
+                linemap->write(linemaps[i].data(), linemaps[i].size());
+                std::string().swap(linemaps[i]);
+            }
+        }
+        append_number(charmap_text, offsets.back());
+        charmap_text += "\t\n";   // blank file name == end
+        charmap.write(charmap_text.data(), charmap_text.size());
     }
-
-    charmap << out.tellp() << "\t\n";   // blank file name == end
-    fs::resize_file(out_file, out.tellp()); // pubseekoff operations can lead to ghost data
-    out.close();
     charmap.close();
     if (linemap) linemap->close();
 
+    if (aliases) {
+        std::string aliases_text;
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (distinct(i)) continue;
+            append_number(aliases_text, offsets[representatives[i]]);
+            aliases_text.push_back('\t');
+            aliases_text += inputs[i].path().string();
+            aliases_text.push_back('\n');
+        }
+        aliases->write(aliases_text.data(), aliases_text.size());
+        aliases->close();
+    }
+
     std::cout << "\nDone!\n";
 }
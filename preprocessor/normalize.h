@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <immintrin.h>
+#include "transform.h"
+
+// The kernels normalizing spaces and newlines (-ns, -ntr, -nl2s) over blocks of 16 (SSE4.2) or 32 (AVX2) characters,
+// the instruction set being picked at run time. Both pack the kept characters of a block with byte shuffles, eight
+// at a time, from the table below.
+
+// for each byte mask, the shuffle moving the bytes of its set bits to the front
+struct PackTable {
+    uint64_t shuffles[256];
+
+    constexpr PackTable() : shuffles() {
+        for (unsigned mask = 0; mask < 256; mask++) {
+            uint64_t shuffle = 0;
+            unsigned count = 0;
+            for (unsigned bit = 0; bit < 8; bit++) {
+                if (mask >> bit & 1) shuffle |= uint64_t(bit) << (8 * count++);
+            }
+            for (; count < 8; count++) shuffle |= uint64_t(0x80) << (8 * count);
+            shuffles[mask] = shuffle;
+        }
+    }
+};
+
+inline constexpr PackTable pack_table{};
+
+#pragma GCC push_options
+#pragma GCC target("sse4.2,popcnt")
+namespace sse42 {
+    // packs the kept characters of a 16-character block to out, writing 16 bytes; returns their count
+    inline unsigned pack(char *out, __m128i block, uint32_t keep) {
+        uint32_t low = keep & 0xff, high = keep >> 8 & 0xff;
+        __m128i shuffle = _mm_set_epi64x(pack_table.shuffles[high] + 0x0808080808080808,
+                                         pack_table.shuffles[low]);
+        __m128i packed = _mm_shuffle_epi8(block, shuffle);
+        unsigned count = __builtin_popcount(low);
+        _mm_storel_epi64((__m128i *) out, packed);
+        _mm_storel_epi64((__m128i *) (out + count), _mm_unpackhi_epi64(packed, packed));
+        return count + __builtin_popcount(high);
+    }
+
+    struct Isa {
+        static constexpr unsigned width = 16;
+
+        static __m128i load(const char *in) { return _mm_loadu_si128((const __m128i *) in); }
+
+        static void store(char *out, __m128i block) { _mm_storeu_si128((__m128i *) out, block); }
+
+        static __m128i eq(__m128i block, char c) { return _mm_cmpeq_epi8(block, _mm_set1_epi8(c)); }
+
+        static __m128i or_(__m128i a, __m128i b) { return _mm_or_si128(a, b); }
+
+        static uint32_t bits(__m128i mask) { return _mm_movemask_epi8(mask); }
+
+        static __m128i to_spaces(__m128i block, __m128i mask) {
+            return _mm_blendv_epi8(block, _mm_set1_epi8(SPACE_CHAR), mask);
+        }
+
+        static unsigned compact(char *out, __m128i block, uint32_t keep) {
+            if (keep == 0xffff) {
+                store(out, block);
+                return 16;
+            }
+            return pack(out, block, keep);
+        }
+    };
+
+#include "normalize_kernel.h"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,popcnt")
+namespace avx2 {
+    struct Isa {
+        static constexpr unsigned width = 32;
+
+        static __m256i load(const char *in) { return _mm256_loadu_si256((const __m256i *) in); }
+
+        static void store(char *out, __m256i block) { _mm256_storeu_si256((__m256i *) out, block); }
+
+        static __m256i eq(__m256i block, char c) { return _mm256_cmpeq_epi8(block, _mm256_set1_epi8(c)); }
+
+        static __m256i or_(__m256i a, __m256i b) { return _mm256_or_si256(a, b); }
+
+        static uint32_t bits(__m256i mask) { return _mm256_movemask_epi8(mask); }
+
+        static __m256i to_spaces(__m256i block, __m256i mask) {
+            return _mm256_blendv_epi8(block, _mm256_set1_epi8(SPACE_CHAR), mask);
+        }
+
+        // the halves are packed one after the other
+        static unsigned compact(char *out, __m256i block, uint32_t keep) {
+            if (keep == UINT32_MAX) {
+                store(out, block);
+                return 32;
+            }
+            unsigned count = sse42::pack(out, _mm256_castsi256_si128(block), keep & 0xffff);
+            return count + sse42::pack(out + count, _mm256_extracti128_si256(block, 1), keep >> 16);
+        }
+    };
+
+#include "normalize_kernel.h"
+}
+#pragma GCC pop_options
+
+// the kernel for flags named (avx2, sse4.2 or scalar) if the processor supports it, or the fastest one; nullptr if
+// unsupported
+inline NormalizeKernel select_kernel(unsigned flags, const std::string &name = "") {
+    __builtin_cpu_init();
+    bool has_popcnt = __builtin_cpu_supports("popcnt");
+    bool has_avx2 = has_popcnt && __builtin_cpu_supports("avx2");
+    bool has_sse42 = has_popcnt && __builtin_cpu_supports("sse4.2");
+    if (name.empty()) {
+        return has_avx2 ? avx2::kernels[flags] : has_sse42 ? sse42::kernels[flags] : scalar_kernels[flags];
+    }
+    if (name == "avx2") return has_avx2 ? avx2::kernels[flags] : nullptr;
+    if (name == "sse4.2") return has_sse42 ? sse42::kernels[flags] : nullptr;
+    if (name == "scalar") return scalar_kernels[flags];
+    return nullptr;
+}
@@ -0,0 +1,79 @@
+// The vector kernel normalizing spaces and newlines, over blocks of Isa::width characters, instantiated for each
+// combination of flags. Included by normalize.h once per instruction set, inside the namespace and under the target
+// of its Isa.
+//
+// A block is classified into bit masks (bit i for its i-th character): the characters skipped by -ns are the blanks
+// following a blank, and those erased by -ntr the blanks kept before a newline, found from each newline back to the
+// character that is not blank before it. The kept characters are packed to the output with spaces for the blanks
+// and newlines the options turn into spaces. A line starts at the output position of its newline, counted before the
+// spaces the newline erases. Blocks without any of those characters are copied as they are.
+
+template<unsigned Flags>
+size_t normalize(const char *in, size_t n, char *out, size_t pos, NormalizeState &state,
+                 std::vector<unsigned long> &lines) {
+    constexpr unsigned width = Isa::width;
+    constexpr uint32_t all = uint32_t(uint64_t(1) << width) - 1;
+    constexpr bool ns = Flags & NORMALIZE_SPACES, nl2s = Flags & NEWLINES_TO_SPACES, linemap = Flags & LINEMAP;
+    constexpr bool ntr = (Flags & REMOVE_TRAILING_SPACES) && !nl2s;   // without newlines left, no space is trailing
+
+    size_t i = 0;
+    for (; i + width <= n; i += width) {
+        auto block = Isa::load(in + i);
+        auto space = Isa::eq(block, ' ');
+        auto lf = Isa::eq(block, '\n');
+        auto newline = Isa::or_(lf, Isa::eq(block, '\r'));
+        auto blank = Isa::or_(space, Isa::eq(block, '\t'));
+        if constexpr (nl2s) blank = Isa::or_(blank, newline);
+        auto to_space = ns ? blank : newline;   // the characters written as spaces
+
+        uint32_t lfs = Isa::bits(lf);
+        uint32_t newlines = Isa::bits(newline);
+        uint32_t blanks = Isa::bits(blank);
+        uint32_t changed = (ns || nl2s) ? Isa::bits(to_space) & ~Isa::bits(space) : 0;
+        uint32_t skipped = ns ? blanks & ((blanks << 1) | state.last_blank) & all : 0;
+        uint32_t kept = ~skipped & all;
+
+        if (!(skipped | changed) && !((ntr || linemap) ? newlines : 0)) {
+            Isa::store(out + pos, block);
+            pos += width;
+        } else {
+            uint32_t ends = ntr ? newlines : 0;
+            uint32_t erased = 0;
+            unsigned long carried = 0;   // spaces ending the previous blocks, erased by the first newline
+            for (uint32_t rest = ends; rest; rest &= rest - 1) {
+                uint32_t before = (rest & -rest) - 1;
+                uint32_t others = ~blanks & before;
+                if (others) {
+                    erased |= blanks & kept & before & ~((2u << (31 - __builtin_clz(others))) - 1);
+                } else {
+                    erased |= blanks & kept & before;
+                    carried = state.space_count;
+                }
+            }
+
+            for (uint32_t rest = linemap ? lfs : 0; rest; rest &= rest - 1) {
+                uint32_t before = (rest & -rest) - 1;
+                uint32_t previous_ends = ends & before;
+                uint32_t done = previous_ends ? (1u << (31 - __builtin_clz(previous_ends))) - 1 : 0;
+                lines.push_back(pos + __builtin_popcount(kept & before) - __builtin_popcount(erased & done)
+                                - (previous_ends ? carried : 0));
+            }
+
+            pos -= carried;
+            pos += Isa::compact(out + pos, (ns || nl2s) ? Isa::to_spaces(block, to_space) : block, kept & ~erased);
+        }
+
+        if constexpr (ns) state.last_blank = blanks >> (width - 1);
+        if constexpr (ntr) {
+            uint32_t others = ~blanks & all;
+            uint32_t last_run = others ? all & ~((2u << (31 - __builtin_clz(others))) - 1) : all;
+            state.space_count = (others ? 0 : state.space_count) + __builtin_popcount(blanks & kept & last_run);
+        }
+    }
+    return normalize_chars<Flags>(in + i, n - i, out, pos, state, lines);
+}
+
+// the kernels of the instruction set, by flags
+inline constexpr auto kernels = make_flag_table([](auto flags) -> NormalizeKernel {
+    return normalize<decltype(flags)::value & KERNEL_FLAGS>;
+});
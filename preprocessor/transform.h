@@ -0,0 +1,372 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char SPACE_CHAR = ' ';
+static const char EOF_CHAR = char(26);
+
+enum comment {
+    plain, comment_start, multiline_end, quote, line_comment, multiline_comment
+};
+
+// what the normalization of spaces carries from one block of a file to the next
+struct NormalizeState {
+    bool last_blank = false;            // -ns: the spaces and tabs that follow are skipped
+    unsigned long space_count = 0;      // -ntr: spaces ending the output, erased by the next newline
+};
+
+// normalizes the n characters of in into out from position pos, returns the position after them; see normalize.h
+using NormalizeKernel = size_t (*)(const char *in, size_t n, char *out, size_t pos, NormalizeState &state,
+                                   std::vector<unsigned long> &lines);
+
+struct TransformOptions {
+    // (\h+)       -> ' '
+    bool normalize_spaces;
+    // (\h+\r?\n)  -> ''
+    bool remove_trailing_spaces;
+    // (\r?\n)     -> '\n'
+    bool normalize_newlines;
+    // (\r?\n)     -> ' '
+    bool newlines_to_spaces;
+    bool delete_comments;
+    bool eof;
+    bool linemap;
+    NormalizeKernel kernel;     // for the flags of the options
+};
+
+// The options applied to every character, as the flags the transformations are instantiated for: each combination
+// gets its own loop, without the tests of the options left out.
+enum TransformFlag : unsigned {
+    NORMALIZE_SPACES = 1,
+    REMOVE_TRAILING_SPACES = 2,
+    NORMALIZE_NEWLINES = 4,
+    NEWLINES_TO_SPACES = 8,
+    DELETE_COMMENTS = 16,
+    LINEMAP = 32,
+    TRANSFORM_COMBINATIONS = 64
+};
+
+// the flags seen by the normalization kernels, which get the input without carriage returns
+static const unsigned KERNEL_FLAGS = NORMALIZE_SPACES | REMOVE_TRAILING_SPACES | NEWLINES_TO_SPACES | LINEMAP;
+
+inline unsigned transform_flags(const TransformOptions &opts) {
+    return (opts.normalize_spaces ? NORMALIZE_SPACES : 0u) | (opts.remove_trailing_spaces ? REMOVE_TRAILING_SPACES : 0u)
+           | (opts.normalize_newlines ? NORMALIZE_NEWLINES : 0u) | (opts.newlines_to_spaces ? NEWLINES_TO_SPACES : 0u)
+           | (opts.delete_comments ? DELETE_COMMENTS : 0u) | (opts.linemap ? LINEMAP : 0u);
+}
+
+// the table of make(std::integral_constant<unsigned, flags>()) for every combination of flags
+template<typename Make, size_t... Flags>
+constexpr auto make_flag_table(Make make, std::index_sequence<Flags...>) {
+    return std::array{make(std::integral_constant<unsigned, Flags>())...};
+}
+
+template<typename Make>
+constexpr auto make_flag_table(Make make) {
+    return make_flag_table(make, std::make_index_sequence<TRANSFORM_COMBINATIONS>());
+}
+
+// the output of one file, placed in the concat once the sizes of the files before it are known
+struct TransformedFile {
+    std::string data;
+    std::vector<unsigned long> lines;   // offsets in data of the newlines, line 2 onwards
+};
+
+inline void append_number(std::string &out, unsigned long value) {
+    char buffer[24];
+    auto res = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, res.ptr - buffer);
+}
+
+// appends the linemap entries of a file placed at offset in the concat: its first line, then its newlines
+inline void append_linemap(std::string &out, unsigned long offset, const std::vector<unsigned long> &lines) {
+    out.reserve(out.size() + 16 * (lines.size() + 1));
+    unsigned long line_nb = 1;
+    append_number(out, offset);
+    out += "\t1\n";
+    for (unsigned long line : lines) {
+        append_number(out, offset + line);
+        out.push_back('\t');
+        append_number(out, ++line_nb);
+        out.push_back('\n');
+    }
+}
+
+// reads the whole content of a file
+inline void read_file(const std::string &path, std::string &content) {
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st{};
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        throw std::runtime_error(std::strerror(errno));
+    }
+    content.resize(st.st_size);
+    size_t filled = 0;
+    while (true) {
+        if (filled == content.size()) content.resize(std::max<size_t>(2 * filled, 1 << 16));   // the file grew
+        ssize_t n = read(fd, &content[filled], content.size() - filled);
+        if (n < 0) {
+            close(fd);
+            throw std::runtime_error(std::strerror(errno));
+        }
+        if (n == 0) break;
+        filled += n;
+    }
+    content.resize(filled);
+    close(fd);
+}
+
+// appends input to out without its carriage returns
+inline void append_without_cr(std::string &out, std::string_view input) {
+    out.reserve(out.size() + input.size());
+    for (const char *p = input.data(), *end = p + input.size(); p != end;) {
+        auto cr = static_cast<const char *>(std::memchr(p, '\r', end - p));
+        out.append(p, (cr ? cr : end) - p);
+        p = cr ? cr + 1 : end;
+    }
+}
+
+// Appends input to out.data, without its carriage returns with -nl, and the offsets of its newlines to out.lines: the
+// transformation of files when neither comments nor spaces are touched, run over whole blocks.
+template<unsigned Flags>
+void copy_lines(std::string_view input, TransformedFile &out) {
+    std::string &data = out.data;
+    size_t start = data.size();
+    if constexpr ((Flags & NORMALIZE_NEWLINES) != 0) {
+        append_without_cr(data, input);
+    } else {
+        data.append(input);
+    }
+
+    if constexpr ((Flags & LINEMAP) != 0) {
+        const char *begin = data.data();
+        for (const char *p = begin + start, *end = begin + data.size();
+             (p = static_cast<const char *>(std::memchr(p, '\n', end - p))); ++p) {
+            out.lines.push_back(p - begin);
+        }
+    }
+}
+
+// Appends the transformed content of input to out.data, one character at a time: the transformation of files whose
+// comments or spaces are removed. Erasing trailing spaces or comments truncates the output, which never goes back
+// past the start of the buffer of the file.
+template<unsigned Flags>
+void transform_chars(std::string_view input, TransformedFile &out) {
+    std::string &data = out.data;
+    auto erase = [&](unsigned long count) {
+        data.resize(data.size() - std::min<size_t>(count, data.size()));
+    };
+
+    bool skip_next_space = false;
+    unsigned long space_count = 0;
+    bool escape = false;
+    enum comment comment = plain;
+    unsigned long comment_length = 0;
+
+    for (unsigned char byte : input) {
+        int c = byte;
+        // process data in buffer
+        if constexpr ((Flags & NORMALIZE_NEWLINES) != 0) {
+            if (c == '\r') {
+                continue;
+            }
+        }
+
+        if constexpr ((Flags & LINEMAP) != 0) {
+            if (c == '\n') {
+                out.lines.push_back(data.size());
+            }
+        }
+
+        if constexpr ((Flags & DELETE_COMMENTS) != 0) {
+            if (!escape) {
+                switch (c) {
+                    case '\\': {
+                        escape = true;
+                        break;
+                    }
+                    case '\n': {
+                        if (comment != multiline_comment) {
+                            erase(comment_length);   // erase comment
+                            comment_length = 0;
+                            comment = plain;
+                        }
+                        break;
+                    }
+                    case '/': {
+                        if (comment == plain) {
+                            comment = comment_start;
+                        } else if (comment == comment_start) {
+                            comment = line_comment;
+                        } else if (comment == multiline_end) {
+                            erase(comment_length);   // erase comment
+                            comment_length = 0;
+                            comment = plain;
+                            continue;   // not writing the end of the comment
+                        }
+                        break;
+                    }
+                    case '*': {
+                        if (comment == comment_start) {
+                            comment = multiline_comment;
+                        } else if (comment == multiline_comment) {
+                            comment = multiline_end;
+                        }
+                        break;
+                    }
+                    case '"': {
+                        if (comment == plain) {
+                            comment = quote;
+                        } else if (comment == quote) {
+                            comment = plain;
+                        }
+                        break;
+                    }
+                    default: {
+                        if (comment == comment_start) {
+                            comment = plain;
+                        } else if (comment == multiline_end) {
+                            comment = multiline_comment;
+                        }
+                    }
+                }
+            } else if (c != '\r') { // line continuation support on windows
+                escape = false;
+            }
+
+            if (comment != plain && comment != quote) {
+                comment_length++;
+            }
+        }
+
+        if constexpr ((Flags & NEWLINES_TO_SPACES) != 0) {
+            if (c == '\n' || c == '\r') {
+                c = SPACE_CHAR;
+            }
+        }
+
+        // space normalization must be after space-producing transformations
+        if constexpr ((Flags & NORMALIZE_SPACES) != 0) {
+            if ((c == ' ' || c == '\t')) {
+                if (skip_next_space) {
+                    continue;
+                }
+                c = SPACE_CHAR;
+                skip_next_space = true;
+            } else {
+                skip_next_space = false;
+            }
+        }
+
+        if constexpr ((Flags & REMOVE_TRAILING_SPACES) != 0) {
+            if (space_count > 0 && (c == '\n' || c == '\r')) {
+                erase(space_count);   // erase spaces
+            }
+            if ((c == ' ' || c == '\t')) {
+                space_count++;
+            } else {
+                space_count = 0;
+            }
+        }
+
+        data.push_back((char) c);
+    }
+}
+
+// The normalization of spaces and newlines of transform_chars, without comments and carriage returns: the scalar
+// kernel, and the end of the blocks of the vector ones.
+template<unsigned Flags>
+size_t normalize_chars(const char *in, size_t n, char *out, size_t pos, NormalizeState &state,
+                       std::vector<unsigned long> &lines) {
+    for (size_t i = 0; i < n; i++) {
+        char c = in[i];
+        if constexpr ((Flags & LINEMAP) != 0) {
+            if (c == '\n') {
+                lines.push_back(pos);
+            }
+        }
+        if constexpr ((Flags & NEWLINES_TO_SPACES) != 0) {
+            if (c == '\n' || c == '\r') {
+                c = SPACE_CHAR;
+            }
+        }
+        bool blank = c == ' ' || c == '\t';
+        if constexpr ((Flags & NORMALIZE_SPACES) != 0) {
+            if (blank && state.last_blank) {
+                continue;
+            }
+            if (blank) {
+                c = SPACE_CHAR;
+            }
+            state.last_blank = blank;
+        }
+        if constexpr ((Flags & REMOVE_TRAILING_SPACES) != 0) {
+            if (state.space_count > 0 && (c == '\n' || c == '\r')) {
+                pos -= state.space_count;   // erase spaces
+            }
+            state.space_count = blank ? state.space_count + 1 : 0;
+        }
+        out[pos++] = c;
+    }
+    return pos;
+}
+
+// the scalar kernels, by flags
+inline constexpr auto scalar_kernels = make_flag_table([](auto flags) -> NormalizeKernel {
+    return normalize_chars<decltype(flags)::value & KERNEL_FLAGS>;
+});
+
+// Appends the content of input to out.data with its spaces and newlines normalized by kernel, once its carriage
+// returns are dropped with -nl. The kernels store whole blocks, hence the room left past the output.
+template<unsigned Flags>
+void normalize_file(std::string_view input, NormalizeKernel kernel, TransformedFile &out) {
+    std::string without_cr;
+    if ((Flags & NORMALIZE_NEWLINES) && input.find('\r') != std::string_view::npos) {
+        append_without_cr(without_cr, input);
+        input = without_cr;
+    }
+
+    std::string &data = out.data;
+    size_t start = data.size();
+    data.resize(start + input.size() + 64);
+    NormalizeState state;
+    data.resize(kernel(input.data(), input.size(), &data[0], start, state, out.lines));
+}
+
+// appends the transformed content of input to out.data
+using TransformFunction = void (*)(std::string_view input, const TransformOptions &opts, TransformedFile &out);
+
+template<unsigned Flags>
+void transform_file(std::string_view input, const TransformOptions &opts, TransformedFile &out) {
+    if constexpr ((Flags & DELETE_COMMENTS) != 0) {
+        transform_chars<Flags>(input, out);
+    } else if constexpr ((Flags & (NORMALIZE_SPACES | REMOVE_TRAILING_SPACES | NEWLINES_TO_SPACES)) != 0) {
+        normalize_file<Flags>(input, opts.kernel ? opts.kernel : scalar_kernels[Flags], out);
+    } else {
+        copy_lines<Flags>(input, out);
+    }
+
+    if (opts.eof) {
+        out.data.push_back(EOF_CHAR);
+    }
+}
+
+// the transformation of files instantiated for the flags of opts
+inline TransformFunction select_transform(const TransformOptions &opts) {
+    static constexpr auto transforms = make_flag_table([](auto flags) -> TransformFunction {
+        return transform_file<decltype(flags)::value>;
+    });
+    return transforms[transform_flags(opts)];
+}
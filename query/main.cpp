@@ -0,0 +1,125 @@
+#include <iostream>
+#include <algorithm>
+#include <optional>
+#include <fnmatch.h>
+#include "../util/ArgParser.h"
+#include "../util/jsonrecord.h"
+#include "../util/linepipeline.h"
+#include "../util/pgzipstream.h"
+
+struct Predicates {
+    unsigned long min_length;
+    unsigned long max_length;
+    unsigned long min_occurrences;
+    unsigned long max_occurrences;
+    unsigned long min_lines;
+    unsigned long max_lines;
+    std::optional<std::vector<std::string>> path_globs;
+};
+
+// number of characters of a decoded (UTF-8) text, as counted by the python scripts
+unsigned long text_length(const std::string &text) {
+    return std::count_if(text.begin(), text.end(), [](char c) { return (c & 0xC0) != 0x80; });
+}
+
+bool matches(const RepeatRecord &record, const Predicates &pred) {
+    unsigned long length = text_length(record.text);
+    if (length < pred.min_length || length > pred.max_length) {
+        return false;
+    }
+    if (record.location_count < pred.min_occurrences || record.location_count > pred.max_occurrences) {
+        return false;
+    }
+
+    auto begin = record.locations.begin();
+    auto end = begin + record.location_count;
+    // every location must span an allowed number of lines
+    if (!std::all_of(begin, end, [&pred](const RepeatLocation &loc) {
+        unsigned long lines = loc.end_line - loc.start_line + 1;
+        return lines >= pred.min_lines && lines <= pred.max_lines;
+    })) {
+        return false;
+    }
+    // at least one location must match one of the path globs
+    return !pred.path_globs || std::any_of(begin, end, [&pred](const RepeatLocation &loc) {
+        return std::any_of(pred.path_globs->begin(), pred.path_globs->end(), [&loc](const std::string &glob) {
+            return fnmatch(glob.c_str(), loc.path.c_str(), 0) == 0;
+        });
+    });
+}
+
+unsigned long numeric_arg(ArgParser &args, const std::string &option, unsigned long default_value) {
+    auto value = args.getCmdArg(option);
+    return value ? std::stoul(*value) : default_value;
+}
+
+int main(int argc, char **argv) {
+    ArgParser args(argv + 1, argv + argc);
+
+    if (args.cmdOptionExists("-h") || args.cmdOptionExists("--help")) {
+        std::cout << "\nUsage:\t" << argv[0]
+                  << "\t[-i <input_file>]\t[-o <output_file>]\t[<options...>]\n"
+                     "Filters the JSON lines of the postprocessor (plain or gzip-compressed).\n"
+                     "\t--min-length <n> --max-length <n>\tlength of the repeated text\n"
+                     "\t--min-occ <n> --max-occ <n>\t\tnumber of locations\n"
+                     "\t--min-lines <n> --max-lines <n>\t\tlines spanned by every location\n"
+                     "\t--path <glob...>\t\t\tat least one location path matching a glob\n"
+                     "\t--compress\t\t\t\tgzip the output\n"
+                     "\t-j <n>\t\t\t\t\tnumber of worker threads\n";
+        exit(1);
+    }
+
+    const unsigned long unbounded = -1;
+    Predicates pred{
+            numeric_arg(args, "--min-length", 0),
+            numeric_arg(args, "--max-length", unbounded),
+            numeric_arg(args, "--min-occ", 0),
+            numeric_arg(args, "--max-occ", unbounded),
+            numeric_arg(args, "--min-lines", 0),
+            numeric_arg(args, "--max-lines", unbounded),
+            args.getCmdArgs("--path")
+    };
+    unsigned threads = numeric_arg(args, "-j", std::max(1u, std::thread::hardware_concurrency()));
+    std::optional<std::string> input_file = args.getCmdArg("-i");
+    std::optional<std::string> output_file = args.getCmdArg("-o");
+    bool compress = args.cmdOptionExists("--compress");
+
+    // compressed input is detected and decompressed ahead of the parsing
+    std::unique_ptr<std::istream> inp(
+            input_file ? (std::istream *) new pgzstr::ifstream(*input_file) : new pgzstr::istream(dup(STDIN_FILENO)));
+    std::unique_ptr<std::ostream> outp;
+    if (output_file) {
+        outp.reset(compress ? (std::ostream *) new pgzstr::ofstream(*output_file, threads)
+                            : new std::ofstream(*output_file, std::ios_base::binary));
+    } else if (compress) {
+        outp.reset(new pgzstr::ostream(stdout, threads));
+    }
+    std::ostream &out = outp ? *outp : std::cout;
+
+    if (!*inp || !out) {
+        std::cerr << "input or output file open fails. exit.\n";
+        exit(1);
+    }
+
+    try {
+        process_line_blocks(*inp, out, threads, [&pred](std::string_view block, std::string &result) {
+            JsonRecordParser parser;
+            RepeatRecord record;
+            for_each_line(block, [&](std::string_view line) {
+                parser.parse(line, record);
+                if (matches(record, pred)) {
+                    result.append(line.data(), line.size());
+                    result.push_back('\n');
+                }
+            });
+        });
+    } catch (std::exception &e) {
+        std::cerr << "Failed to filter repeats: " << e.what() << "\n";
+        exit(1);
+    }
+    if (!pgzstr::close_output(out)) {
+        std::cerr << "output file write fails. exit.\n";
+        exit(1);
+    }
+    return 0;
+}
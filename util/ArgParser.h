@@ -4,6 +4,7 @@
 #include <set>
 #include <filesystem>
 #include <algorithm>
+#include <cctype>
 #include <fstream>
 #include <iostream>
 
@@ -47,7 +48,8 @@ public:
             if (found != end) {
                 char **arg = found + 1;
 
-                if (arg == end || *arg[0] == '-') {
+                // a negative number is an argument, not the next option
+                if (arg == end || (*arg[0] == '-' && !std::isdigit((unsigned char) (*arg)[1]))) {
                     throw std::invalid_argument(option + " requires an argument after it.");
                 }
 
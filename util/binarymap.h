@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Binary charmap and linemap, used in place once mapped. After a 32-byte header, the sorted and distinct start
+// offsets of the entries are stored as an array of 64-bit integers, followed by their values: 32-bit line numbers,
+// or the 64-bit offsets of the paths in a string table that ends the file (one more, for the end of the last path).
+// Integers are in native byte order.
+namespace binarymap {
+    static const char MAGIC[8] = {'C', 'R', 'P', 'O', 'S', 'M', 'A', 'P'};
+
+    enum Kind : uint32_t {
+        LINES = 1,
+        PATHS = 2
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t kind;
+        uint32_t version;
+        uint64_t count;
+        uint64_t strings_size;  // of the string table of paths
+    };
+
+    // whether data starts as a binary map
+    inline bool is_binary(std::string_view data) {
+        return data.size() >= sizeof(MAGIC) && std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) == 0;
+    }
+
+    // Sorts map entries by offset as they were written: for offsets written more than once (empty files, or lines
+    // whose text was erased after them), the last value is kept.
+    template<typename T>
+    void sort_entries(std::vector<std::pair<unsigned long, T>> &entries) {
+        auto by_offset = [](const auto &a, const auto &b) { return a.first < b.first; };
+        if (!std::is_sorted(entries.begin(), entries.end(), by_offset)) {
+            std::stable_sort(entries.begin(), entries.end(), by_offset);
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (kept && entries[kept - 1].first == entries[i].first) kept--;
+            if (kept != i) entries[kept] = std::move(entries[i]);
+            kept++;
+        }
+        entries.resize(kept);
+    }
+
+    template<typename T>
+    void write_array(std::ostream &out, const std::vector<T> &values) {
+        out.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+    }
+
+    // the header and the offsets of sorted entries
+    template<typename T>
+    void write_offsets(std::ostream &out, Kind kind, const std::vector<std::pair<unsigned long, T>> &entries,
+                       uint64_t strings_size) {
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.kind = kind;
+        header.version = 1;
+        header.count = entries.size();
+        header.strings_size = strings_size;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+        std::vector<uint64_t> offsets;
+        offsets.reserve(entries.size());
+        for (auto &entry : entries) offsets.push_back(entry.first);
+        write_array(out, offsets);
+    }
+
+    // writes a linemap from its sorted entries
+    inline void write_lines(std::ostream &out, const std::vector<std::pair<unsigned long, unsigned int>> &entries) {
+        write_offsets(out, LINES, entries, 0);
+        std::vector<uint32_t> lines;
+        lines.reserve(entries.size());
+        for (auto &entry : entries) lines.push_back(entry.second);
+        write_array(out, lines);
+    }
+
+    // writes a charmap from its sorted entries
+    inline void write_paths(std::ostream &out, const std::vector<std::pair<unsigned long, std::string>> &entries) {
+        std::vector<uint64_t> starts{0};
+        for (auto &entry : entries) starts.push_back(starts.back() + entry.second.size());
+        write_offsets(out, PATHS, entries, starts.back());
+        write_array(out, starts);
+        for (auto &entry : entries) out.write(entry.second.data(), entry.second.size());
+    }
+
+    // a binary map read in place
+    struct View {
+        size_t count = 0;
+        const uint64_t *offsets = nullptr;
+        const uint32_t *lines = nullptr;
+        const uint64_t *path_starts = nullptr;
+        const char *strings = nullptr;
+
+        std::string_view path(size_t i) const {
+            return {strings + path_starts[i], path_starts[i + 1] - path_starts[i]};
+        }
+    };
+
+    // the view of data holding a binary map of the given kind; throws if it does not
+    inline View view(std::string_view data, Kind kind) {
+        Header header{};
+        if (!is_binary(data) || data.size() < sizeof(header)) throw std::runtime_error("not a binary map");
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (header.kind != kind || header.version != 1) throw std::runtime_error("unexpected kind of binary map");
+
+        uint64_t count = header.count;
+        uint64_t values_size = kind == LINES ? count * sizeof(uint32_t) : (count + 1) * sizeof(uint64_t);
+        if ((data.size() - sizeof(header)) / sizeof(uint64_t) < count
+            || data.size() - sizeof(header) - count * sizeof(uint64_t) < values_size + header.strings_size) {
+            throw std::runtime_error("truncated binary map");
+        }
+
+        View v;
+        v.count = count;
+        v.offsets = reinterpret_cast<const uint64_t *>(data.data() + sizeof(header));
+        const char *values = data.data() + sizeof(header) + count * sizeof(uint64_t);
+        if (kind == LINES) {
+            v.lines = reinterpret_cast<const uint32_t *>(values);
+        } else {
+            v.path_starts = reinterpret_cast<const uint64_t *>(values);
+            v.strings = values + values_size;
+            if (v.path_starts[count] > header.strings_size) throw std::runtime_error("truncated binary map");
+        }
+        return v;
+    }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bit vector with a rank directory of one cumulative count per 512 bits. rank is constant time, select narrows the
+// block by binary search over the directory and finishes inside at most eight words.
+class RankSelect {
+private:
+    static constexpr size_t block_words = 8;
+    std::vector<uint64_t> words;
+    std::vector<uint64_t> blocks;   // number of ones before each block
+    size_t bits = 0;
+
+    // position of the k-th one (0-based) inside w
+    static unsigned select_in_word(uint64_t w, unsigned k) {
+        while (k--) w &= w - 1;
+        return __builtin_ctzll(w);
+    }
+
+    template<bool One>
+    uint64_t ones_before_block(size_t b) const {
+        return One ? blocks[b] : b * block_words * 64 - blocks[b];
+    }
+
+    template<bool One>
+    size_t select(uint64_t k) const {
+        // last block with fewer than k + 1 matching bits before it
+        size_t lo = 0, hi = blocks.size();
+        while (hi - lo > 1) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (ones_before_block<One>(mid) <= k) lo = mid;
+            else hi = mid;
+        }
+        k -= ones_before_block<One>(lo);
+        for (size_t w = lo * block_words;; w++) {
+            uint64_t word = One ? words[w] : ~words[w];
+            auto count = (uint64_t) __builtin_popcountll(word);
+            if (k < count) return w * 64 + select_in_word(word, (unsigned) k);
+            k -= count;
+        }
+    }
+
+public:
+    RankSelect() = default;
+
+    explicit RankSelect(size_t size) : words((size + 63) / 64 + block_words, 0), bits(size) {}
+
+    void set(size_t i) { words[i / 64] |= uint64_t(1) << (i % 64); }
+
+    bool get(size_t i) const { return (words[i / 64] >> (i % 64)) & 1; }
+
+    size_t size() const { return bits; }
+
+    // to be called once all the bits are set
+    void build() {
+        blocks.assign((words.size() + block_words - 1) / block_words + 1, 0);
+        uint64_t count = 0;
+        for (size_t w = 0; w < words.size(); w++) {
+            if (w % block_words == 0) blocks[w / block_words] = count;
+            count += __builtin_popcountll(words[w]);
+        }
+        blocks.back() = count;
+    }
+
+    // number of ones in [0, i)
+    uint64_t rank1(size_t i) const {
+        size_t w = i / 64;
+        uint64_t count = blocks[w / block_words];
+        for (size_t j = w - w % block_words; j < w; j++) count += __builtin_popcountll(words[j]);
+        if (i % 64) count += __builtin_popcountll(words[w] << (64 - i % 64));
+        return count;
+    }
+
+    // position of the k-th one / zero (0-based), which must exist
+    size_t select1(uint64_t k) const { return select<true>(k); }
+
+    size_t select0(uint64_t k) const { return select<false>(k); }
+
+    size_t memory() const { return (words.size() + blocks.size()) * sizeof(uint64_t); }
+};
+
+// Elias-Fano encoding of a sorted sequence of integers: n values below u take about n * (2 + log2(u / n)) bits.
+// Each value is split in low bits, stored packed, and high bits, stored in unary in a RankSelect vector.
+class EliasFano {
+private:
+    RankSelect upper;
+    std::vector<uint64_t> lower;
+    unsigned low_bits = 0;
+    size_t count = 0;
+
+    uint64_t low(size_t i) const {
+        if (!low_bits) return 0;
+        size_t bit = i * low_bits;
+        uint64_t value = lower[bit / 64] >> (bit % 64);
+        if (bit % 64 + low_bits > 64) value |= lower[bit / 64 + 1] << (64 - bit % 64);
+        return value & ((uint64_t(1) << low_bits) - 1);
+    }
+
+public:
+    EliasFano() = default;
+
+    // values must be sorted
+    explicit EliasFano(const std::vector<uint64_t> &values) : EliasFano(values.data(), values.size()) {}
+
+    EliasFano(const uint64_t *values, size_t n) : count(n) {
+        uint64_t universe = n == 0 ? 1 : values[n - 1] + 1;
+        while (count && (universe >> (low_bits + 1)) >= count) low_bits++;
+
+        upper = RankSelect((universe >> low_bits) + count + 1);
+        lower.assign((count * low_bits + 63) / 64 + 1, 0);
+        for (size_t i = 0; i < count; i++) {
+            upper.set((values[i] >> low_bits) + i);
+            if (low_bits) {
+                uint64_t value = values[i] & ((uint64_t(1) << low_bits) - 1);
+                size_t bit = i * low_bits;
+                lower[bit / 64] |= value << (bit % 64);
+                if (bit % 64 + low_bits > 64) lower[bit / 64 + 1] |= value >> (64 - bit % 64);
+            }
+        }
+        upper.build();
+    }
+
+    size_t size() const { return count; }
+
+    uint64_t operator[](size_t i) const {
+        return ((uint64_t) (upper.select1(i) - i) << low_bits) | low(i);
+    }
+
+    // number of values <= x
+    size_t rank(uint64_t x) const {
+        uint64_t high = x >> low_bits;
+        if (high >= upper.size() - count) return count;   // past the last high part
+        // values with a high part below or equal to high end at its zero in the unary encoding
+        size_t end = upper.select0(high) - high;
+        size_t begin = high ? upper.select0(high - 1) - (high - 1) : 0;
+        uint64_t x_low = x & ((uint64_t(1) << low_bits) - 1);
+        while (end > begin && low(end - 1) > x_low) end--;
+        return end;
+    }
+
+    size_t memory() const { return upper.memory() + lower.size() * sizeof(uint64_t); }
+};
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdexcept>
+#include <charconv>
+
+// one location of a repeat, as emitted by the postprocessor
+struct RepeatLocation {
+    std::string path;
+    unsigned long start_line = 0;
+    unsigned long end_line = 0;
+};
+
+// one line of the postprocessor's JSON output
+struct RepeatRecord {
+    std::string text;
+    std::vector<RepeatLocation> locations;
+    size_t location_count = 0;  // locations[0, location_count) are valid, the rest is kept for reuse
+};
+
+// Parser for the postprocessor's JSON lines. It understands any JSON value (unknown fields are skipped),
+// but only extracts what the native tools need. Records are reused between lines to avoid allocations.
+class JsonRecordParser {
+private:
+    const char *p = nullptr;
+    const char *end = nullptr;
+    std::string key;
+
+    [[noreturn]] void fail(const char *what) {
+        throw std::runtime_error(std::string("malformed JSON record: ") + what);
+    }
+
+    void skip_ws() {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p;
+    }
+
+    void expect(char c) {
+        skip_ws();
+        if (p == end || *p != c) fail("unexpected character");
+        ++p;
+    }
+
+    bool consume(char c) {
+        skip_ws();
+        if (p != end && *p == c) {
+            ++p;
+            return true;
+        }
+        return false;
+    }
+
+    static void append_utf8(std::string &out, unsigned cp) {
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    unsigned hex4() {
+        if (end - p < 4) fail("truncated \\u escape");
+        unsigned value = 0;
+        auto res = std::from_chars(p, p + 4, value, 16);
+        if (res.ptr != p + 4) fail("invalid \\u escape");
+        p += 4;
+        return value;
+    }
+
+    // decodes a string value into out (or just skips it if out is null)
+    void string(std::string *out) {
+        expect('"');
+        if (out) out->clear();
+        while (true) {
+            const char *run = p;
+            while (p != end && *p != '"' && *p != '\\') ++p;
+            if (out) out->append(run, p - run);
+            if (p == end) fail("unterminated string");
+            if (*p++ == '"') return;
+            if (p == end) fail("unterminated escape");
+            char e = *p++;
+            if (!out) {
+                if (e == 'u') hex4();
+                continue;
+            }
+            switch (e) {
+                case 'b': out->push_back('\b'); break;
+                case 'f': out->push_back('\f'); break;
+                case 'n': out->push_back('\n'); break;
+                case 'r': out->push_back('\r'); break;
+                case 't': out->push_back('\t'); break;
+                case 'u': {
+                    unsigned cp = hex4();
+                    if (cp >= 0xD800 && cp < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                        p += 2;
+                        unsigned low = hex4();
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(*out, cp);
+                    break;
+                }
+                default: out->push_back(e);    // '"', '\\' and '/'
+            }
+        }
+    }
+
+    unsigned long number() {
+        skip_ws();
+        unsigned long value = 0;
+        auto res = std::from_chars(p, end, value);
+        if (res.ec != std::errc()) fail("expected an unsigned number");
+        p = res.ptr;
+        return value;
+    }
+
+    void skip_value() {
+        skip_ws();
+        if (p == end) fail("missing value");
+        switch (*p) {
+            case '"':
+                string(nullptr);
+                break;
+            case '{':
+                ++p;
+                if (consume('}')) break;
+                do {
+                    string(nullptr);
+                    expect(':');
+                    skip_value();
+                } while (consume(','));
+                expect('}');
+                break;
+            case '[':
+                ++p;
+                if (consume(']')) break;
+                do {
+                    skip_value();
+                } while (consume(','));
+                expect(']');
+                break;
+            default:    // numbers and literals
+                while (p != end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t') ++p;
+        }
+    }
+
+    void location(RepeatLocation &loc) {
+        loc.path.clear();
+        loc.start_line = loc.end_line = 0;
+        expect('{');
+        if (consume('}')) return;
+        do {
+            string(&key);
+            expect(':');
+            if (key == "path") string(&loc.path);
+            else if (key == "start_line") loc.start_line = number();
+            else if (key == "end_line") loc.end_line = number();
+            else skip_value();
+        } while (consume(','));
+        expect('}');
+    }
+
+public:
+    void parse(std::string_view line, RepeatRecord &record) {
+        p = line.data();
+        end = line.data() + line.size();
+        record.text.clear();
+        record.location_count = 0;
+
+        expect('{');
+        if (consume('}')) return;
+        do {
+            string(&key);
+            expect(':');
+            if (key == "text") {
+                string(&record.text);
+            } else if (key == "locations") {
+                expect('[');
+                if (consume(']')) continue;
+                do {
+                    if (record.location_count == record.locations.size()) record.locations.emplace_back();
+                    location(record.locations[record.location_count++]);
+                } while (consume(','));
+                expect(']');
+            } else {
+                skip_value();
+            }
+        } while (consume(','));
+        expect('}');
+    }
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <charconv>
+#include <string>
+#include <string_view>
+#include "stringescape.h"
+
+// Appends JSON to a string buffer: literal pieces are copied as they are, strings are escaped and integers are
+// formatted with to_chars, without going through a stream.
+class JsonWriter {
+private:
+    std::string &out;
+
+public:
+    explicit JsonWriter(std::string &out) : out(out) {}
+
+    JsonWriter &raw(std::string_view text) {
+        out.append(text.data(), text.size());
+        return *this;
+    }
+
+    JsonWriter &raw(char ch) {
+        out.push_back(ch);
+        return *this;
+    }
+
+    JsonWriter &string(std::string_view text) {
+        append_escaped_string(out, text);
+        return *this;
+    }
+
+    JsonWriter &number(unsigned long value) {
+        char digits[20];
+        auto res = std::to_chars(digits, digits + sizeof(digits), value);
+        out.append(digits, res.ptr - digits);
+        return *this;
+    }
+};
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+// Runs transform(task, output) on the tasks returned by produce(task) (until it returns false) with a pool of
+// worker threads, and passes the outputs to consume(output) in production order from a single writer thread.
+// produce runs on the calling thread; at most two tasks per worker are held in memory. The first exception
+// thrown by a transform is rethrown once the pipeline has drained. Outputs are strings unless Result says otherwise.
+template<typename Task, typename Result = std::string, typename Produce, typename Transform, typename Consume>
+void run_ordered(unsigned threads, Produce produce, Transform transform, Consume consume) {
+    if (threads == 0) threads = 1;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::pair<size_t, Task>> work;
+    std::map<size_t, Result> done;
+    size_t in_flight = 0;
+    size_t tasks = 0;
+    bool producing = true;
+    std::exception_ptr error;
+
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [&] { return !work.empty() || !producing; });
+            if (work.empty()) return;
+            auto task = std::move(work.front());
+            work.pop_front();
+            lock.unlock();
+
+            Result result{};
+            try {
+                transform(task.second, result);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(mutex);
+                if (!error) error = std::current_exception();
+            }
+
+            lock.lock();
+            done.emplace(task.first, std::move(result));
+            cv.notify_all();
+        }
+    };
+
+    auto writer = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (size_t next = 0;; ++next) {
+            cv.wait(lock, [&] { return done.count(next) || (!producing && next == tasks); });
+            if (!producing && next == tasks) return;
+            auto node = done.extract(next);
+            lock.unlock();
+            try {
+                consume(node.mapped());
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(mutex);
+                if (!error) error = std::current_exception();
+            }
+            lock.lock();
+            --in_flight;
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++) pool.emplace_back(worker);
+    std::thread output_thread(writer);
+
+    try {
+        Task task;
+        while (produce(task)) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return in_flight < 2 * threads; });
+            work.emplace_back(tasks++, std::move(task));
+            ++in_flight;
+            cv.notify_all();
+            task = Task();
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!error) error = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        producing = false;
+    }
+    cv.notify_all();
+    for (auto &t : pool) t.join();
+    output_thread.join();
+
+    if (error) std::rethrow_exception(error);
+}
+
+// Splits the input into blocks, cut after the last complete record found by cut(block) (the length of the prefix
+// made of whole records, std::string::npos if there is none), and runs them through run_ordered. The remainder of
+// a block starts the next one; the last block is passed whole.
+template<typename Result = std::string, typename Cut, typename Transform, typename Consume>
+void process_blocks(std::istream &in, unsigned threads, Cut cut, Transform transform, Consume consume,
+                    size_t block_size = (size_t) 4 << 20) {
+    std::string carry;
+    auto produce = [&](std::string &block) {
+        while (in) {
+            block = std::move(carry);
+            carry.clear();
+            size_t filled = block.size();
+            block.resize(filled + block_size);
+            in.read(&block[filled], block_size);
+            block.resize(filled + in.gcount());
+
+            if (in) {
+                size_t end = cut(std::string_view(block));
+                if (end == std::string::npos) {
+                    carry = std::move(block);
+                    continue;
+                }
+                carry.assign(block, end, std::string::npos);
+                block.resize(end);
+            }
+            if (!block.empty()) return true;
+        }
+        return false;
+    };
+    run_ordered<std::string, Result>(threads, produce, [&transform](std::string &block, Result &result) {
+        transform(std::string_view(block), result);
+    }, consume);
+}
+
+// process_blocks over data already in memory, such as a mapped file: the blocks are views into it.
+template<typename Result = std::string, typename Cut, typename Transform, typename Consume>
+void process_view_blocks(std::string_view data, unsigned threads, Cut cut, Transform transform, Consume consume,
+                         size_t block_size = (size_t) 4 << 20) {
+    auto produce = [&](std::string_view &block) {
+        if (data.empty()) return false;
+        size_t end = std::string_view::npos;
+        for (size_t window = block_size; end == std::string_view::npos || end == 0; window *= 2) {
+            end = window >= data.size() ? data.size() : cut(data.substr(0, window));
+        }
+        block = data.substr(0, end);
+        data.remove_prefix(end);
+        return true;
+    };
+    run_ordered<std::string_view, Result>(threads, produce, [&transform](std::string_view &block, Result &result) {
+        transform(block, result);
+    }, consume);
+}
+
+// Splits the input into blocks of whole lines, runs transform(lines, output) on each block with a pool of
+// worker threads, and writes the outputs in input order. At most two blocks per worker are held in memory.
+template<typename Transform>
+void process_line_blocks(std::istream &in, std::ostream &out, unsigned threads, Transform transform,
+                         size_t block_size = (size_t) 4 << 20) {
+    process_blocks(in, threads, [](std::string_view block) {
+        size_t cut = block.rfind('\n');
+        return cut == std::string_view::npos ? cut : cut + 1;
+    }, transform, [&out](const std::string &result) {
+        out.write(result.data(), result.size());
+    }, block_size);
+}
+
+// calls f(line) for every line of a block, without the line terminator
+template<typename F>
+void for_each_line(std::string_view block, F f) {
+    while (!block.empty()) {
+        size_t eol = block.find('\n');
+        std::string_view line = block.substr(0, eol);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (!line.empty()) f(line);
+        if (eol == std::string_view::npos) break;
+        block.remove_prefix(eol + 1);
+    }
+}
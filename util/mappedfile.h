@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// read-only memory mapping of a whole file, released on destruction
+class MappedFile {
+private:
+    const char *ptr = nullptr;
+    size_t length = 0;
+
+    void release() {
+        if (ptr) munmap(const_cast<char *>(ptr), length);
+        ptr = nullptr;
+        length = 0;
+    }
+
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string &path, int advice = MADV_NORMAL) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+        }
+        struct stat st{};
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("cannot stat " + path + ": " + std::strerror(errno));
+        }
+        length = st.st_size;
+        if (length > 0) {   // mmap refuses empty mappings, an empty file is simply an empty view
+            void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+            }
+            madvise(mapped, length, advice);
+            ptr = static_cast<const char *>(mapped);
+        }
+        close(fd);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept: ptr(other.ptr), length(other.length) {
+        other.ptr = nullptr;
+        other.length = 0;
+    }
+
+    MappedFile &operator=(MappedFile &&other) noexcept {
+        if (this != &other) {
+            release();
+            std::swap(ptr, other.ptr);
+            std::swap(length, other.length);
+        }
+        return *this;
+    }
+
+    ~MappedFile() {
+        release();
+    }
+
+    const char *data() const { return ptr; }
+
+    size_t size() const { return length; }
+
+    std::string_view view() const { return {ptr, length}; }
+};
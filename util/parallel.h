@@ -0,0 +1,37 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Calls f(i) for every i in [0, count) on a pool of threads, handing out indices in order as threads become free.
+// The first exception thrown by f stops the handing out and is rethrown once all threads are done.
+template<typename F>
+void parallel_for(size_t count, unsigned threads, F f) {
+    threads = std::max(1u, (unsigned) std::min<size_t>(threads, count));
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::exception_ptr error;
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                f(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(mutex);
+                if (!error) error = std::current_exception();
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool) t.join();
+
+    if (error) std::rethrow_exception(error);
+}
@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "pgzip.h"
+
+#define PGZ_BLOCK (128 * 1024)
+#define PGZ_DICT (32 * 1024)
+
+typedef struct pgz_job {
+	unsigned char* in;
+	size_t in_len;
+	unsigned char dict[PGZ_DICT];	/* end of the input before this block */
+	size_t dict_len;
+	unsigned char* out;
+	size_t out_len, out_cap;
+	unsigned long crc;
+	int last;
+	int done;
+	int error;
+} pgz_job;
+
+struct pgzip {
+	FILE* fp;
+	int level;
+
+	pthread_t* threads;
+	unsigned nthreads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+
+	/* ring of jobs: job number k lives in jobs[k % njobs] */
+	pgz_job* jobs;
+	unsigned njobs;
+	unsigned long long queued, taken, written;
+
+	unsigned char* cur;	/* block being filled */
+	size_t cur_len;
+	unsigned char dict[PGZ_DICT];	/* end of the input queued so far */
+	size_t dict_len;
+
+	unsigned long crc;
+	unsigned long long total;
+	int error;
+};
+
+/** Workers **/
+
+static void pgz_deflate(pgzip* gz, pgz_job* job) {
+	z_stream strm;
+	int ret, flush = job->last ? Z_FINISH : Z_SYNC_FLUSH;
+	size_t cap;
+
+	memset(&strm, 0, sizeof(strm));
+	if (deflateInit2(&strm, gz->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		job->error = 1;
+		return;
+	}
+	if (job->dict_len) deflateSetDictionary(&strm, job->dict, job->dict_len);
+
+	/* room for the whole block and the sync flush marker, grown if ever needed */
+	cap = deflateBound(&strm, job->in_len) + 16;
+	if (job->out_cap < cap) {
+		free(job->out);
+		job->out = (unsigned char*)malloc(cap);
+		job->out_cap = cap;
+	}
+	strm.next_in = job->in;
+	strm.avail_in = job->in_len;
+	strm.next_out = job->out;
+	strm.avail_out = job->out_cap;
+	while ((ret = deflate(&strm, flush)) == Z_OK && strm.avail_out == 0) {
+		size_t used = job->out_cap;
+		job->out_cap *= 2;
+		job->out = (unsigned char*)realloc(job->out, job->out_cap);
+		strm.next_out = job->out + used;
+		strm.avail_out = job->out_cap - used;
+	}
+	job->error = !job->out || (job->last ? ret != Z_STREAM_END : ret != Z_OK || strm.avail_in);
+	job->out_len = job->out_cap - strm.avail_out;
+	job->crc = crc32(0L, job->in, job->in_len);
+	deflateEnd(&strm);
+}
+
+static void* pgz_worker(void* arg) {
+	pgzip* gz = (pgzip*)arg;
+	pgz_job* job;
+
+	pthread_mutex_lock(&gz->lock);
+	for (;;) {
+		while (gz->taken == gz->queued && !gz->stop) pthread_cond_wait(&gz->cond, &gz->lock);
+		if (gz->taken == gz->queued) break;
+		job = &gz->jobs[gz->taken++ % gz->njobs];
+		pthread_mutex_unlock(&gz->lock);
+		pgz_deflate(gz, job);
+		pthread_mutex_lock(&gz->lock);
+		job->done = 1;
+		pthread_cond_broadcast(&gz->cond);
+	}
+	pthread_mutex_unlock(&gz->lock);
+	return NULL;
+}
+
+/** Ordered output, on the writing thread (called with the lock held) **/
+
+/* Writes the finished jobs in order. Waits for the jobs until at most
+ * pending remain queued. */
+static void pgz_write_done(pgzip* gz, unsigned long long pending) {
+	pgz_job* job;
+	while (gz->written < gz->queued) {
+		job = &gz->jobs[gz->written % gz->njobs];
+		if (!job->done) {
+			if (gz->queued - gz->written <= pending) break;
+			pthread_cond_wait(&gz->cond, &gz->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&gz->lock);
+		if (job->error || fwrite(job->out, 1, job->out_len, gz->fp) != job->out_len) gz->error = 1;
+		gz->crc = crc32_combine(gz->crc, job->crc, job->in_len);
+		gz->total += job->in_len;
+		pthread_mutex_lock(&gz->lock);
+		gz->written++;
+	}
+}
+
+static void pgz_submit(pgzip* gz, int last) {
+	pgz_job* job;
+	unsigned char* tmp;
+	size_t keep;
+
+	pthread_mutex_lock(&gz->lock);
+	pgz_write_done(gz, gz->njobs - 1);
+
+	job = &gz->jobs[gz->queued % gz->njobs];
+	tmp = job->in;
+	job->in = gz->cur;
+	job->in_len = gz->cur_len;
+	gz->cur = tmp;
+	gz->cur_len = 0;
+	memcpy(job->dict, gz->dict, gz->dict_len);
+	job->dict_len = gz->dict_len;
+	job->last = last;
+	job->done = 0;
+
+	/* the dictionary of the next block is the end of the input so far */
+	if (job->in_len >= PGZ_DICT) {
+		memcpy(gz->dict, job->in + job->in_len - PGZ_DICT, PGZ_DICT);
+		gz->dict_len = PGZ_DICT;
+	} else {
+		keep = gz->dict_len + job->in_len > PGZ_DICT ? PGZ_DICT - job->in_len : gz->dict_len;
+		memmove(gz->dict, gz->dict + gz->dict_len - keep, keep);
+		memcpy(gz->dict + keep, job->in, job->in_len);
+		gz->dict_len = keep + job->in_len;
+	}
+
+	gz->queued++;
+	pthread_cond_broadcast(&gz->cond);
+	pthread_mutex_unlock(&gz->lock);
+}
+
+/** Interface **/
+
+pgzip* pgzip_open(FILE* fp, int level, unsigned threads) {
+	static const unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};	/* deflate, no mtime, Unix */
+	pgzip* gz;
+	unsigned i;
+
+	if (!fp) return NULL;
+	if (!threads) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (unsigned)cpus : 1;
+	}
+	gz = (pgzip*)calloc(1, sizeof(pgzip));
+	gz->fp = fp;
+	gz->level = level;
+	gz->nthreads = threads;
+	gz->njobs = 2 * threads;
+	gz->jobs = (pgz_job*)calloc(gz->njobs, sizeof(pgz_job));
+	for (i = 0; i < gz->njobs; i++) gz->jobs[i].in = (unsigned char*)malloc(PGZ_BLOCK);
+	gz->cur = (unsigned char*)malloc(PGZ_BLOCK);
+	gz->crc = crc32(0L, Z_NULL, 0);
+	pthread_mutex_init(&gz->lock, NULL);
+	pthread_cond_init(&gz->cond, NULL);
+
+	gz->threads = (pthread_t*)malloc(threads * sizeof(pthread_t));
+	for (i = 0; i < threads; i++) pthread_create(&gz->threads[i], NULL, pgz_worker, gz);
+
+	if (fwrite(header, 1, sizeof(header), fp) != sizeof(header)) gz->error = 1;
+	return gz;
+}
+
+int pgzip_write(pgzip* gz, const void* buf, size_t n) {
+	const unsigned char* p = (const unsigned char*)buf;
+	size_t k;
+
+	while (n) {
+		k = PGZ_BLOCK - gz->cur_len < n ? PGZ_BLOCK - gz->cur_len : n;
+		memcpy(gz->cur + gz->cur_len, p, k);
+		gz->cur_len += k;
+		p += k;
+		n -= k;
+		if (gz->cur_len == PGZ_BLOCK) pgz_submit(gz, 0);
+	}
+	return !gz->error;
+}
+
+int pgzip_close(pgzip* gz) {
+	unsigned char trailer[8];
+	unsigned i;
+	int ok;
+
+	pgz_submit(gz, 1);
+	pthread_mutex_lock(&gz->lock);
+	pgz_write_done(gz, 0);
+	gz->stop = 1;
+	pthread_cond_broadcast(&gz->cond);
+	pthread_mutex_unlock(&gz->lock);
+	for (i = 0; i < gz->nthreads; i++) pthread_join(gz->threads[i], NULL);
+
+	/* CRC-32 and size modulo 2^32, little endian */
+	for (i = 0; i < 4; i++) {
+		trailer[i] = (unsigned char)(gz->crc >> (8 * i));
+		trailer[4 + i] = (unsigned char)(gz->total >> (8 * i));
+	}
+	if (fwrite(trailer, 1, sizeof(trailer), gz->fp) != sizeof(trailer)) gz->error = 1;
+	if (fclose(gz->fp)) gz->error = 1;
+	ok = !gz->error;
+
+	for (i = 0; i < gz->njobs; i++) {
+		free(gz->jobs[i].in);
+		free(gz->jobs[i].out);
+	}
+	free(gz->jobs);
+	free(gz->cur);
+	free(gz->threads);
+	pthread_mutex_destroy(&gz->lock);
+	pthread_cond_destroy(&gz->cond);
+	free(gz);
+	return ok;
+}
+
+static ssize_t pgz_cookie_write(void* cookie, const char* buf, size_t n) {
+	return pgzip_write((pgzip*)cookie, buf, n) ? (ssize_t)n : -1;
+}
+
+static int pgz_cookie_close(void* cookie) {
+	return pgzip_close((pgzip*)cookie) ? 0 : EOF;
+}
+
+FILE* pgzip_fwrap(FILE* fp, int level, unsigned threads) {
+	cookie_io_functions_t io = {NULL, pgz_cookie_write, NULL, pgz_cookie_close};
+	pgzip* gz = pgzip_open(fp, level, threads);
+	FILE* f;
+
+	if (!gz) return NULL;
+	f = fopencookie(gz, "w", io);
+	if (!f) pgzip_close(gz);
+	return f;
+}
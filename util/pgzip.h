@@ -0,0 +1,52 @@
+#ifndef __PGZIP_H__
+#define __PGZIP_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Block-parallel gzip compression
+ *
+ * The input is cut in blocks that are deflated independently by a pool of
+ * threads, each primed with the last 32 KiB of the previous block as its
+ * dictionary (as pigz does), and written in order. Blocks end on a sync
+ * flush, so that their concatenation is a single deflate stream: the output
+ * is one standard gzip member, readable by gzip, zlib and zstr.
+ */
+
+typedef struct pgzip pgzip;
+
+#define PGZIP_DEFAULT_LEVEL (-1)	/* Z_DEFAULT_COMPRESSION */
+
+/**
+ * Starts a gzip stream written to fp (which the stream then owns).
+ * threads = 0 uses all online processors. Returns NULL on failure.
+ */
+pgzip* pgzip_open(FILE* fp, int level, unsigned threads);
+
+/**
+ * Compresses n bytes of buf. Returns 0 on failure.
+ */
+int pgzip_write(pgzip* gz, const void* buf, size_t n);
+
+/**
+ * Writes the remaining blocks and the gzip trailer, closes the underlying
+ * file and releases the stream. Returns 0 on failure.
+ */
+int pgzip_close(pgzip* gz);
+
+/**
+ * A stdio stream over pgzip_open(fp, ...): everything written to it is
+ * compressed, and fclose finishes the gzip stream and closes fp.
+ */
+FILE* pgzip_fwrap(FILE* fp, int level, unsigned threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __PGZIP_H__
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "pgzip.h"
+
+// Drop-in replacements for the zstr streams. Output streams compress with the block-parallel gzip of pgzip.h, the
+// output is a single standard gzip member. Input streams decompress ahead of the reader on a thread of their own.
+namespace pgzstr {
+
+class ostreambuf : public std::streambuf {
+private:
+    pgzip *gz;
+    std::vector<char> buffer;
+
+    bool flush_buffer() {
+        std::ptrdiff_t n = pptr() - pbase();
+        setp(buffer.data(), buffer.data() + buffer.size());
+        return n == 0 || pgzip_write(gz, buffer.data(), n);
+    }
+
+public:
+    // takes ownership of fp, closed with the stream
+    ostreambuf(FILE *fp, unsigned threads, int level)
+            : gz(pgzip_open(fp, level, threads)), buffer((size_t) 1 << 17) {
+        setp(buffer.data(), buffer.data() + buffer.size());
+    }
+
+    ostreambuf(const ostreambuf &) = delete;
+
+    ostreambuf &operator=(const ostreambuf &) = delete;
+
+    ~ostreambuf() override {
+        close();
+    }
+
+    bool is_open() const { return gz != nullptr; }
+
+    // writes what is buffered, the last blocks and the gzip trailer, and closes the file; false if any of it fails
+    bool close() {
+        if (!gz) return true;
+        bool ok = flush_buffer();
+        ok = pgzip_close(gz) && ok;
+        gz = nullptr;
+        return ok;
+    }
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (!gz || !flush_buffer()) return traits_type::eof();
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        if (n < epptr() - pptr()) return std::streambuf::xsputn(s, n);
+        // large writes go straight to the compressor
+        if (!gz || !flush_buffer() || !pgzip_write(gz, s, n)) return 0;
+        return n;
+    }
+};
+
+class ostream : public std::ostream {
+public:
+    explicit ostream(FILE *fp, unsigned threads = 0, int level = PGZIP_DEFAULT_LEVEL)
+            : std::ostream(new ostreambuf(fp, threads, level)) {
+        if (!static_cast<ostreambuf *>(rdbuf())->is_open()) setstate(std::ios_base::badbit);
+    }
+
+    ~ostream() override {
+        delete rdbuf();
+    }
+
+    // sets badbit if the end of the output cannot be written
+    void close() {
+        if (!static_cast<ostreambuf *>(rdbuf())->close()) setstate(std::ios_base::badbit);
+    }
+};
+
+class ofstream : public ostream {
+public:
+    explicit ofstream(const std::string &path, unsigned threads = 0, int level = PGZIP_DEFAULT_LEVEL)
+            : ostream(std::fopen(path.c_str(), "wb"), threads, level) {}
+};
+
+// Closes an output stream, compressed or not, or flushes it if it is not a file; false if the output is incomplete.
+inline bool close_output(std::ostream &out) {
+    if (auto *gz = dynamic_cast<ostream *>(&out)) {
+        gz->close();
+    } else if (auto *file = dynamic_cast<std::ofstream *>(&out)) {
+        file->close();
+    } else {
+        out.flush();
+    }
+    return !out.fail();
+}
+
+// Decompresses on a producer thread into a bounded queue of large blocks, so that inflating overlaps with the
+// parsing of the blocks already decoded. Concatenated gzip members (as written by parallel gzip tools) are read in
+// sequence, and uncompressed input is passed through.
+class istreambuf : public std::streambuf {
+private:
+    static constexpr size_t block_size = (size_t) 4 << 20;
+    static constexpr size_t queue_depth = 4;
+
+    gzFile gz;
+    std::string block;          // being read
+    std::deque<std::string> ready;
+    std::vector<std::string> spare;
+    bool finished = false;
+    bool stopping = false;
+    std::string error;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread producer;
+
+    void produce() {
+        while (true) {
+            std::string next;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return ready.size() < queue_depth || stopping; });
+                if (stopping) break;
+                if (!spare.empty()) {
+                    next = std::move(spare.back());
+                    spare.pop_back();
+                }
+            }
+            next.resize(block_size);
+            int n = gzread(gz, &next[0], block_size);
+            // gzread returns what was decoded before a truncation as if the input ended there, gzerror tells
+            int errnum = Z_OK;
+            const char *message = gzerror(gz, &errnum);
+
+            std::lock_guard<std::mutex> guard(mutex);
+            if (n > 0) {
+                next.resize(n);
+                ready.push_back(std::move(next));
+                cv.notify_all();
+            }
+            if (n < 0 || errnum != Z_OK) {
+                // drop the "<fd:N>: " prefix of the message
+                error = message && *message ? message : "decompression failed";
+                if (error.compare(0, 4, "<fd:") == 0 && error.find(": ") != std::string::npos) {
+                    error.erase(0, error.find(": ") + 2);
+                }
+            }
+            if (n <= 0 || errnum != Z_OK) break;
+        }
+        std::lock_guard<std::mutex> guard(mutex);
+        finished = true;
+        cv.notify_all();
+    }
+
+public:
+    // takes ownership of fd, closed with the stream
+    explicit istreambuf(int fd) : gz(fd < 0 ? nullptr : gzdopen(fd, "rb")) {
+        if (!gz) {
+            if (fd >= 0) close(fd);
+            return;
+        }
+        gzbuffer(gz, 1 << 17);
+        setg(nullptr, nullptr, nullptr);
+        producer = std::thread(&istreambuf::produce, this);
+    }
+
+    istreambuf(const istreambuf &) = delete;
+
+    istreambuf &operator=(const istreambuf &) = delete;
+
+    ~istreambuf() override {
+        if (!gz) return;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        producer.join();
+        gzclose(gz);
+    }
+
+    bool is_open() const { return gz != nullptr; }
+
+protected:
+    int_type underflow() override {
+        if (gptr() != egptr()) return traits_type::to_int_type(*gptr());
+        if (!gz) return traits_type::eof();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return !ready.empty() || finished; });
+        if (ready.empty()) {
+            if (!error.empty()) throw std::runtime_error("Failed to decompress input: " + error);
+            return traits_type::eof();
+        }
+        spare.push_back(std::move(block));
+        block = std::move(ready.front());
+        ready.pop_front();
+        cv.notify_all();
+        lock.unlock();
+
+        setg(&block[0], &block[0], &block[0] + block.size());
+        return traits_type::to_int_type(*gptr());
+    }
+};
+
+class istream : public std::istream {
+public:
+    explicit istream(int fd) : std::istream(new istreambuf(fd)) {
+        exceptions(std::ios_base::badbit);   // decompression errors are rethrown to the reader, as with zstr
+        if (!static_cast<istreambuf *>(rdbuf())->is_open()) setstate(std::ios_base::failbit);
+    }
+
+    ~istream() override {
+        delete rdbuf();
+    }
+};
+
+class ifstream : public istream {
+public:
+    explicit ifstream(const std::string &path) : istream(::open(path.c_str(), O_RDONLY)) {}
+};
+
+}
@@ -1,7 +1,11 @@
 #pragma once
 
-#include <fstream>
-#include <ctype.h>
+#include <string>
+#include <string_view>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 unsigned int utf8ToCodepoint(const char *&s, const char *e) {
     const unsigned int REPLACEMENT_CHARACTER = 0xFFFD;
@@ -71,53 +75,79 @@ static const char hex2[] = "000102030405060708090a0b0c0d0e0f"
                            "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
                            "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
 
-static void appendRaw(std::ostream &out, unsigned ch) {
-    out << static_cast<char>(ch);
+// escape sequence written for each byte, none (length 0) for the bytes copied as they are: printable ASCII
+// but the quote and the backslash. Other bytes are written as a literal "\\x" followed by their hex code.
+struct EscapeTable {
+    char text[256][5];
+    unsigned char length[256];
+
+    EscapeTable() : text(), length() {
+        for (unsigned ch = 0; ch < 256; ch++) {
+            const char *escape = nullptr;
+            switch (ch) {
+                case '\"': escape = "\\\""; break;
+                case '\\': escape = "\\\\"; break;
+                case '\b': escape = "\\b"; break;
+                case '\f': escape = "\\f"; break;
+                case '\n': escape = "\\n"; break;
+                case '\r': escape = "\\r"; break;
+                case '\t': escape = "\\t"; break;
+                default:
+                    if (ch >= 0x20 && ch < 0x7f) continue;
+                    text[ch][0] = '\\';
+                    text[ch][1] = '\\';
+                    text[ch][2] = 'x';
+                    text[ch][3] = hex2[2 * ch];
+                    text[ch][4] = hex2[2 * ch + 1];
+                    length[ch] = 5;
+                    continue;
+            }
+            length[ch] = std::strlen(escape);
+            std::memcpy(text[ch], escape, length[ch]);
+        }
+    }
+};
+
+inline const EscapeTable &escape_table() {
+    static const EscapeTable table;
+    return table;
 }
 
-static void appendHex(std::ostream &out, unsigned ch) {
-    const unsigned int lo = ch & 0xff;
-    out << "\\\\x";
-    out << hex2[2 * lo];
-    out << hex2[2 * lo + 1];
+// first byte of [p, end) that needs escaping, or end. Sixteen bytes are tested at a time with SSE2.
+inline const char *skip_safe_bytes(const char *p, const char *end, const EscapeTable &table) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        // signed comparison: control characters and bytes >= 0x80 are both below the space
+        __m128i unsafe = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del)),
+                                      _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+        int mask = _mm_movemask_epi8(unsafe);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p != end && !table.length[static_cast<unsigned char>(*p)]) ++p;
+    return p;
 }
 
-void write_escaped_string(std::ostream &out, const std::string &str) {
-    out << '"';
-    char const *value = str.c_str();
-    char const *end = value + str.size();
-
-    for (const char *c = value; c != end; ++c) {
-        switch (*c) {
-            case '\"':
-                out << "\\\"";
-                break;
-            case '\\':
-                out << "\\\\";
-                break;
-            case '\b':
-                out << "\\b";
-                break;
-            case '\f':
-                out << "\\f";
-                break;
-            case '\n':
-                out << "\\n";
-                break;
-            case '\r':
-                out << "\\r";
-                break;
-            case '\t':
-                out << "\\t";
-                break;
-            default: {
-                if (isprint(*c)) {
-                    appendRaw(out, *c);
-                } else {
-                    appendHex(out, *c);
-                }
-            }
-        }
+// appends str as a quoted JSON string: runs of safe bytes are copied in bulk, only escapes are handled one by one
+inline void append_escaped_string(std::string &out, std::string_view str) {
+    const EscapeTable &table = escape_table();
+    const char *p = str.data();
+    const char *end = p + str.size();
+
+    out.push_back('"');
+    while (true) {
+        const char *run = p;
+        p = skip_safe_bytes(p, end, table);
+        out.append(run, p - run);
+        if (p == end) break;
+        auto ch = static_cast<unsigned char>(*p++);
+        out.append(table.text[ch], table.length[ch]);
     }
-    out << '"';
-}
\ No newline at end of file
+    out.push_back('"');
+}
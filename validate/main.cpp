@@ -0,0 +1,197 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include "../util/ArgParser.h"
+#include "../util/jsonrecord.h"
+#include "../util/linepipeline.h"
+#include "../util/mappedfile.h"
+#include "../util/pgzipstream.h"
+
+// a source file mapped once, with the offsets of its lines indexed on first use
+class SourceFile {
+private:
+    MappedFile file;
+    std::once_flag indexed;
+    std::vector<size_t> line_starts;    // followed by the size of the file
+
+    // lines end with "\n", "\r\n" or "\r", as python's universal newlines
+    void index() {
+        std::string_view text = file.view();
+        line_starts.push_back(0);
+        if (text.find('\r') == std::string_view::npos) {
+            for (const char *p = text.data(), *end = p + text.size();
+                 (p = static_cast<const char *>(std::memchr(p, '\n', end - p))); ++p) {
+                line_starts.push_back(p + 1 - text.data());
+            }
+        } else {
+            for (size_t i = 0; i < text.size(); i++) {
+                if (text[i] == '\n' || (text[i] == '\r' && (i + 1 == text.size() || text[i + 1] != '\n'))) {
+                    line_starts.push_back(i + 1);
+                }
+            }
+        }
+        if (line_starts.back() != text.size()) line_starts.push_back(text.size());
+        if (text.empty()) line_starts.clear();
+    }
+
+    static bool is_space(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r') || (c >= '\x1c' && c <= '\x1f');
+    }
+
+public:
+    explicit SourceFile(const std::string &path) : file(path) {}
+
+    // lines first to last (numbered from 1, both inclusive) stripped of surrounding whitespace and joined with
+    // newlines, as scripts/validate.py reads them
+    void lines(unsigned long first, unsigned long last, std::string &out) {
+        std::call_once(indexed, &SourceFile::index, this);
+        out.clear();
+        size_t count = line_starts.empty() ? 0 : line_starts.size() - 1;
+        first = std::max(first, 1ul);
+        last = std::min<unsigned long>(last, count);
+        for (unsigned long line = first; line <= last; line++) {
+            const char *begin = file.data() + line_starts[line - 1];
+            const char *end = file.data() + line_starts[line];
+            while (begin != end && is_space(*begin)) ++begin;
+            while (end != begin && is_space(end[-1])) --end;
+            if (line != first) out.push_back('\n');
+            out.append(begin, end - begin);
+        }
+    }
+};
+
+// source files by path, the least recently used being released beyond capacity
+class SourceCache {
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<SourceFile>>;
+
+    size_t capacity;
+    std::mutex mutex;
+    std::list<Entry> recent;    // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+
+public:
+    explicit SourceCache(size_t capacity) : capacity(std::max<size_t>(capacity, 1)) {}
+
+    std::shared_ptr<SourceFile> get(const std::string &path) {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto found = entries.find(path);
+        if (found != entries.end()) {
+            recent.splice(recent.begin(), recent, found->second);
+            return found->second->second;
+        }
+
+        auto source = std::make_shared<SourceFile>(path);
+        recent.emplace_front(path, source);
+        entries.emplace(path, recent.begin());
+        if (recent.size() > capacity) {
+            entries.erase(recent.back().first);
+            recent.pop_back();  // still mapped while a worker holds it
+        }
+        return source;
+    }
+};
+
+// invalid records and records that could not be checked, of a block of input
+struct Verdicts {
+    std::string invalid;
+    std::string unprocessed;
+};
+
+void validate(std::istream &in, std::ostream &invalid_out, std::ostream &unprocessed_out, unsigned threads,
+              SourceCache &sources) {
+    process_blocks<Verdicts>(in, threads, [](std::string_view block) {
+        size_t cut = block.rfind('\n');
+        return cut == std::string_view::npos ? cut : cut + 1;
+    }, [&sources](std::string_view block, Verdicts &result) {
+        JsonRecordParser parser;
+        RepeatRecord record;
+        std::string text_in_file;
+        for_each_line(block, [&](std::string_view line) {
+            try {
+                parser.parse(line, record);
+                // the text must be found in the lines of every location
+                bool valid = std::all_of(record.locations.begin(), record.locations.begin() + record.location_count,
+                                         [&](const RepeatLocation &loc) {
+                    sources.get(loc.path)->lines(loc.start_line, loc.end_line, text_in_file);
+                    return text_in_file.find(record.text) != std::string::npos;
+                });
+                if (!valid) {
+                    result.invalid.append(line.data(), line.size());
+                    result.invalid.push_back('\n');
+                }
+            } catch (std::exception &e) {
+                result.unprocessed.append(line.data(), line.size());
+                result.unprocessed += " caused an error: ";
+                result.unprocessed += e.what();
+                result.unprocessed.push_back('\n');
+            }
+        });
+    }, [&](const Verdicts &result) {
+        invalid_out.write(result.invalid.data(), result.invalid.size());
+        unprocessed_out.write(result.unprocessed.data(), result.unprocessed.size());
+    });
+}
+
+std::optional<std::string> option(ArgParser &args, const std::string &short_name, const std::string &long_name) {
+    auto value = args.getCmdArg(short_name);
+    return value ? value : args.getCmdArg(long_name);
+}
+
+int main(int argc, char **argv) {
+    ArgParser args(argv + 1, argv + argc);
+
+    if (args.cmdOptionExists("-h") || args.cmdOptionExists("--help")) {
+        std::cout << "\nUsage:\t" << argv[0]
+                  << "\t[-i <input_file>]\t[-o <invalid_file>]\t[-u <unprocessed_file>]\t[<options...>]\n"
+                     "Checks that the text of every JSON line of the postprocessor (plain or gzip-compressed) is\n"
+                     "found in the source lines of each of its locations, and outputs the records that are not.\n"
+                     "\t--cache <n>\tnumber of source files kept mapped\n"
+                     "\t-j <n>\t\tnumber of worker threads\n";
+        exit(1);
+    }
+
+    unsigned threads;
+    size_t cache_size;
+    std::optional<std::string> input_file, output_file, unprocessed_file;
+    try {
+        auto threads_arg = args.getCmdArg("-j");
+        threads = threads_arg ? std::stoul(*threads_arg) : std::max(1u, std::thread::hardware_concurrency());
+        cache_size = std::stoul(args.getCmdArg("--cache").value_or("1024"));
+        input_file = option(args, "-i", "--input");
+        output_file = option(args, "-o", "--output");
+        unprocessed_file = option(args, "-u", "--unprocessed");
+    } catch (std::exception &e) {
+        std::cerr << "Invalid arguments: " << e.what() << "\n";
+        exit(1);
+    }
+
+    std::unique_ptr<std::istream> inp(
+            input_file ? (std::istream *) new pgzstr::ifstream(*input_file) : new pgzstr::istream(dup(STDIN_FILENO)));
+    std::unique_ptr<std::ostream> outp, unprocessedp;
+    if (output_file) outp.reset(new std::ofstream(*output_file, std::ios_base::binary));
+    if (unprocessed_file) unprocessedp.reset(new std::ofstream(*unprocessed_file, std::ios_base::binary));
+    std::ostream &out = outp ? *outp : std::cout;
+    std::ostream &unprocessed = unprocessedp ? *unprocessedp : std::cerr;
+
+    if (!*inp || !out || !unprocessed) {
+        std::cerr << "input or output file open fails. exit.\n";
+        exit(1);
+    }
+
+    SourceCache sources(cache_size);
+    try {
+        validate(*inp, out, unprocessed, threads, sources);
+    } catch (std::exception &e) {
+        std::cerr << "Failed to validate repeats: " << e.what() << "\n";
+        exit(1);
+    }
+    return 0;
+}